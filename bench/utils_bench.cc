@@ -0,0 +1,436 @@
+/*
+ * Micro-benchmarks for the utils.h primitives.
+ *
+ * Build, from the top of the tree, alongside wampcc and OpenSSL:
+ *
+ *   g++ -O2 -std=c++11 -Isrc bench/utils_bench.cc src/utils.cc \
+ *       src/clock.cc src/uri.cc src/csprng.cc \
+ *       -lwampcc -lcrypto -lpthread -o utils_bench
+ *
+ * Usage:
+ *
+ *   utils_bench [--filter SUBSTR] [--threads 1,2,4] [--min-time MS]
+ *               [--json FILE] [--baseline FILE] [--threshold PCT]
+ *
+ * Each benchmark runs in batches, sized so that a batch takes about 20
+ * microseconds, until min-time has elapsed; the per-batch ns/op values give
+ * the percentiles.  Heap allocations are counted by replacing the global
+ * operator new.  With --json the results are written one object per line,
+ * and a file so written can later be given to --baseline; any benchmark
+ * slower than the baseline by more than the threshold (default 10%) is
+ * reported, and makes the exit status non-zero.
+ */
+
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Allocation counting.  Counts are per thread, so benchmarks running
+ * concurrently do not disturb each other. */
+static thread_local uint64_t tls_allocs = 0;
+
+void* operator new(size_t n)
+{
+  tls_allocs++;
+  if (void* p = malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+/* Prevent the compiler discarding a result */
+template <typename T> inline void keep(T&& v)
+{
+  asm volatile("" : : "g"(&v) : "memory");
+}
+
+struct options
+{
+  std::string filter;
+  std::vector<unsigned> threads{1};
+  int min_time_ms = 200;
+  std::string json_file;
+  std::string baseline_file;
+  double threshold_pct = 10.0;
+};
+
+struct result
+{
+  std::string name;
+  unsigned threads;
+  double ns_per_op;
+  double ops_per_sec;
+  double p50, p90, p99;
+  double allocs_per_op;
+};
+
+/* A benchmark body runs its operation 'n' times, and must be safe to run
+ * on several threads at once. */
+struct benchmark
+{
+  std::string name;
+  std::function<void(size_t)> body;
+};
+
+
+double percentile(std::vector<double>& v, double pct)
+{
+  if (v.empty())
+    return 0;
+  size_t idx = std::min(v.size() - 1, (size_t)(pct / 100.0 * v.size()));
+  std::nth_element(v.begin(), v.begin() + idx, v.end());
+  return v[idx];
+}
+
+
+/* Find a batch size taking roughly 'target' */
+size_t calibrate(const benchmark& b, std::chrono::nanoseconds target)
+{
+  size_t n = 1;
+  for (;;) {
+    auto start = clock_type::now();
+    b.body(n);
+    auto elapsed = clock_type::now() - start;
+    if (elapsed >= target || n >= (1u << 30))
+      return std::max<size_t>(1, n * target.count() /
+                                  std::max<int64_t>(1, elapsed.count()));
+    n *= 2;
+  }
+}
+
+
+result run(const benchmark& b, unsigned nthreads, const options& opts)
+{
+  const size_t batch = calibrate(b, std::chrono::microseconds(20));
+  const auto min_time = std::chrono::milliseconds(opts.min_time_ms);
+
+  std::vector<std::vector<double>> samples(nthreads);
+  std::vector<uint64_t> ops(nthreads, 0), allocs(nthreads, 0);
+  std::atomic<unsigned> ready(0);
+  std::atomic<bool> go(false);
+
+  auto worker = [&](unsigned t) {
+    ready++;
+    while (!go.load())
+      std::this_thread::yield();
+
+    /* only allocations made by the body are counted, not the growth of
+     * samples[t] */
+    auto start = clock_type::now();
+    do {
+      uint64_t allocs_before = tls_allocs;
+      auto t0 = clock_type::now();
+      b.body(batch);
+      auto t1 = clock_type::now();
+      allocs[t] += tls_allocs - allocs_before;
+      samples[t].push_back(
+        std::chrono::duration<double, std::nano>(t1 - t0).count() / batch);
+      ops[t] += batch;
+    } while (clock_type::now() - start < min_time);
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < nthreads; t++)
+    pool.emplace_back(worker, t);
+  while (ready.load() < nthreads - 1)
+    std::this_thread::yield();
+
+  auto start = clock_type::now();
+  go = true;
+  worker(0);
+  for (auto& th : pool)
+    th.join();
+  double wall_ns =
+    std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+
+  std::vector<double> all;
+  uint64_t total_ops = 0, total_allocs = 0;
+  for (unsigned t = 0; t < nthreads; t++) {
+    all.insert(all.end(), samples[t].begin(), samples[t].end());
+    total_ops += ops[t];
+    total_allocs += allocs[t];
+  }
+
+  result r;
+  r.name = b.name;
+  r.threads = nthreads;
+  r.ops_per_sec = total_ops / (wall_ns / 1e9);
+  r.ns_per_op = (wall_ns * nthreads) / total_ops;
+  r.p50 = percentile(all, 50);
+  r.p90 = percentile(all, 90);
+  r.p99 = percentile(all, 99);
+  r.allocs_per_op = (double)total_allocs / total_ops;
+  return r;
+}
+
+
+std::vector<benchmark> make_benchmarks()
+{
+  std::vector<benchmark> rv;
+
+  for (size_t len : {8, 32, 128, 512}) {
+    auto uri = std::make_shared<std::string>();
+    while (uri->size() < len)
+      *uri += "com.myapp.";
+    uri->resize(len);
+    if (uri->back() == '.')
+      uri->back() = 'x';
+    rv.push_back({"is_strict_uri/" + std::to_string(len),
+                  [uri](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                      keep(xxx::is_strict_uri(uri->c_str()));
+                  }});
+  }
+
+  const char key[] = "secret-key-0123456789";
+  for (size_t len : {16, 256, 4096}) {
+    auto msg = std::make_shared<std::string>(len, 'm');
+    for (auto mode : {xxx::HMACSHA256_Mode::HEX, xxx::HMACSHA256_Mode::BASE64}) {
+      std::string name = std::string("compute_HMACSHA256/") +
+                         (mode == xxx::HMACSHA256_Mode::HEX ? "hex/" : "base64/") +
+                         std::to_string(len);
+      rv.push_back({name,
+                    [msg, key, mode](size_t n) {
+                      char dest[256];
+                      for (size_t i = 0; i < n; i++) {
+                        unsigned int destlen = sizeof dest;
+                        keep(xxx::compute_HMACSHA256(
+                          key, sizeof key - 1, msg->data(), (int)msg->size(),
+                          dest, &destlen, mode));
+                      }
+                    }});
+    }
+  }
+
+  for (int iterations : {1, 1000, 10000})
+    rv.push_back({"compute_salted_password/" + std::to_string(iterations),
+                  [iterations](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                      keep(xxx::compute_salted_password("password", "salt",
+                                                        iterations, 32));
+                  }});
+
+  for (size_t len : {8, 32, 256}) {
+    rv.push_back({"random_ascii_string/" + std::to_string(len),
+                  [len](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                      keep(xxx::random_ascii_string(len));
+                  }});
+    rv.push_back({"random_ascii_string/seeded/" + std::to_string(len),
+                  [len](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                      keep(xxx::random_ascii_string(len, (unsigned)i));
+                  }});
+  }
+
+  rv.push_back({"local_timestamp",
+                [](size_t n) {
+                  for (size_t i = 0; i < n; i++)
+                    keep(xxx::local_timestamp());
+                }});
+
+  rv.push_back({"iso8601_utc_timestamp",
+                [](size_t n) {
+                  for (size_t i = 0; i < n; i++)
+                    keep(xxx::iso8601_utc_timestamp());
+                }});
+
+  /* not thread safe, so one instance per calling thread */
+  rv.push_back({"global_scope_id_generator::next",
+                [](size_t n) {
+                  thread_local xxx::global_scope_id_generator gen;
+                  for (size_t i = 0; i < n; i++)
+                    keep(gen.next());
+                }});
+
+  auto atomic_gen = std::make_shared<xxx::atomic_scope_id_generator>();
+  rv.push_back({"atomic_scope_id_generator::next",
+                [atomic_gen](size_t n) {
+                  for (size_t i = 0; i < n; i++)
+                    keep(atomic_gen->next());
+                }});
+
+  auto block_gen = std::make_shared<xxx::block_scope_id_generator>();
+  rv.push_back({"block_scope_id_generator::next",
+                [block_gen](size_t n) {
+                  thread_local xxx::block_scope_id_generator::local gen(*block_gen);
+                  for (size_t i = 0; i < n; i++)
+                    keep(gen.next());
+                }});
+
+  for (size_t len : {1, 8, 64}) {
+    auto ja = std::make_shared<wampcc::json_array>();
+    for (size_t i = 0; i < len; i++)
+      ja->push_back(wampcc::json_value("argument-string-" + std::to_string(i)));
+    rv.push_back({"strings/" + std::to_string(len),
+                  [ja](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                      keep(xxx::strings(*ja));
+                  }});
+  }
+
+  return rv;
+}
+
+
+std::string to_json(const result& r)
+{
+  std::ostringstream os;
+  os << "{\"name\": \"" << r.name << "\", \"threads\": " << r.threads
+     << ", \"ns_per_op\": " << r.ns_per_op
+     << ", \"ops_per_sec\": " << r.ops_per_sec << ", \"p50\": " << r.p50
+     << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99
+     << ", \"allocs_per_op\": " << r.allocs_per_op << "}";
+  return os.str();
+}
+
+
+/* Read the results of an earlier --json run, as "name@threads" -> ns/op.
+ * Only files written by this program are understood. */
+std::map<std::string, double> read_baseline(const std::string& filename)
+{
+  std::map<std::string, double> rv;
+  std::ifstream in(filename);
+  if (!in)
+    throw std::runtime_error("cannot open baseline file '" + filename + "'");
+
+  auto field = [](const std::string& line, const std::string& key) {
+    size_t pos = line.find("\"" + key + "\": ");
+    return pos == std::string::npos ? std::string()
+                                    : line.substr(pos + key.size() + 4);
+  };
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string name = field(line, "name");
+    std::string threads = field(line, "threads");
+    std::string ns = field(line, "ns_per_op");
+    if (name.empty() || threads.empty() || ns.empty())
+      continue;
+    name = name.substr(1, name.find('"', 1) - 1);
+    rv[name + "@" + std::to_string(std::atoi(threads.c_str()))] =
+      std::atof(ns.c_str());
+  }
+  return rv;
+}
+
+
+std::vector<unsigned> parse_threads(const std::string& s)
+{
+  std::vector<unsigned> rv;
+  std::istringstream is(s);
+  std::string item;
+  while (std::getline(is, item, ','))
+    if (int n = std::atoi(item.c_str()))
+      rv.push_back(n);
+  if (rv.empty())
+    throw std::runtime_error("invalid --threads '" + s + "'");
+  return rv;
+}
+
+
+options parse_args(int argc, char** argv)
+{
+  options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::runtime_error("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--filter")
+      opts.filter = value();
+    else if (arg == "--threads")
+      opts.threads = parse_threads(value());
+    else if (arg == "--min-time")
+      opts.min_time_ms = std::atoi(value().c_str());
+    else if (arg == "--json")
+      opts.json_file = value();
+    else if (arg == "--baseline")
+      opts.baseline_file = value();
+    else if (arg == "--threshold")
+      opts.threshold_pct = std::atof(value().c_str());
+    else
+      throw std::runtime_error("unknown option '" + arg + "'");
+  }
+  return opts;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+  try {
+    options opts = parse_args(argc, argv);
+
+    std::map<std::string, double> baseline;
+    if (!opts.baseline_file.empty())
+      baseline = read_baseline(opts.baseline_file);
+
+    std::vector<result> results;
+    int regressions = 0;
+
+    printf("%-42s %3s %12s %14s %10s %10s %10s %8s\n", "benchmark", "thr",
+           "ns/op", "ops/sec", "p50", "p90", "p99", "allocs");
+
+    for (auto& b : make_benchmarks()) {
+      if (!opts.filter.empty() && b.name.find(opts.filter) == std::string::npos)
+        continue;
+
+      for (unsigned nthreads : opts.threads) {
+        result r = run(b, nthreads, opts);
+        results.push_back(r);
+        printf("%-42s %3u %12.1f %14.0f %10.1f %10.1f %10.1f %8.2f",
+               r.name.c_str(), r.threads, r.ns_per_op, r.ops_per_sec, r.p50,
+               r.p90, r.p99, r.allocs_per_op);
+
+        auto iter = baseline.find(r.name + "@" + std::to_string(r.threads));
+        if (iter != baseline.end() && iter->second > 0) {
+          double change = 100.0 * (r.ns_per_op - iter->second) / iter->second;
+          printf("  %+6.1f%%", change);
+          if (change > opts.threshold_pct) {
+            printf(" REGRESSION");
+            regressions++;
+          }
+        }
+        printf("\n");
+      }
+    }
+
+    if (!opts.json_file.empty()) {
+      std::ofstream out(opts.json_file);
+      out << "{\"benchmarks\": [\n";
+      for (size_t i = 0; i < results.size(); i++)
+        out << to_json(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+      out << "]}\n";
+    }
+
+    return regressions ? 2 : 0;
+  }
+  catch (const std::exception& e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,347 @@
+#include "async_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace xxx
+{
+
+namespace detail
+{
+
+static size_t round_up_pow2(size_t n)
+{
+  size_t rv = 2;
+  while (rv < n)
+    rv <<= 1;
+  return rv;
+}
+
+log_ring::log_ring(size_t capacity)
+  : slots(new log_record[round_up_pow2(capacity)]),
+    mask(round_up_pow2(capacity) - 1),
+    head(0),
+    cached_tail(0),
+    writing(false),
+    tail(0),
+    retired(false)
+{
+}
+
+} // namespace detail
+
+
+/* Per-thread cache of rings, keyed by logger id.  The cache holds weak
+ * references, so a ring is freed with its logger, and entries of destroyed
+ * loggers are pruned when the thread next looks up an unknown logger.  When
+ * the thread exits its rings are marked retired, and the logger thread frees
+ * them once drained. */
+namespace
+{
+
+struct ring_cache
+{
+  struct item
+  {
+    uint64_t logger_id;
+    std::weak_ptr<detail::log_ring> ring;
+  };
+
+  std::vector<item> items;
+  uint64_t last_id = 0;
+  detail::log_ring* last_ring = nullptr;
+
+  ~ring_cache()
+  {
+    for (auto& x : items)
+      if (auto ring = x.ring.lock())
+        ring->retired.store(true, std::memory_order_release);
+  }
+};
+
+thread_local ring_cache tls_rings;
+
+std::atomic<uint64_t> next_logger_id(1);
+
+const char* level_name(log_level level)
+{
+  switch (level) {
+    case log_level::trace: return "TRACE";
+    case log_level::debug: return "DEBUG";
+    case log_level::info: return "INFO";
+    case log_level::warn: return "WARN";
+    case log_level::error: return "ERROR";
+  };
+  return "";
+}
+
+} // namespace
+
+
+async_logger::async_logger(options opts)
+  : m_id(next_logger_id.fetch_add(1)),
+    m_ring_slots(opts.ring_slots),
+    m_overflow(opts.overflow),
+    m_clock(opts.clock),
+    m_rings_changed(false),
+    m_stopping(false),
+    m_dropped(0),
+    m_file(fopen(opts.filename.c_str(), "a")),
+    m_cached_second(-1)
+{
+  if (!m_file)
+    throw std::runtime_error("cannot open log file '" + opts.filename + "'");
+
+  m_out.reserve(1 << 16);
+  m_thread = std::thread([this]() { run(); });
+}
+
+
+async_logger::~async_logger()
+{
+  stop();
+}
+
+
+void async_logger::stop()
+{
+  std::call_once(m_stopped, [this]() {
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      m_stopping.store(true);
+    }
+    m_cond.notify_one();
+    m_thread.join();
+    fclose(m_file);
+    m_file = nullptr;
+  });
+}
+
+
+detail::log_ring* async_logger::local_ring()
+{
+  ring_cache& cache = tls_rings;
+
+  if (cache.last_id == m_id)
+    return cache.last_ring;
+
+  /* a ring is alive for as long as its logger, so an expired entry belongs
+   * to a destroyed logger */
+  cache.items.erase(
+    std::remove_if(cache.items.begin(), cache.items.end(),
+                   [](const ring_cache::item& x) { return x.ring.expired(); }),
+    cache.items.end());
+
+  for (auto& x : cache.items)
+    if (x.logger_id == m_id) {
+      cache.last_id = m_id;
+      cache.last_ring = x.ring.lock().get();
+      return cache.last_ring;
+    }
+
+  auto ring = std::make_shared<detail::log_ring>(m_ring_slots);
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_rings.push_back(ring);
+    m_rings_changed = true;
+  }
+
+  cache.items.push_back({m_id, ring});
+  cache.last_id = m_id;
+  cache.last_ring = ring.get();
+  return cache.last_ring;
+}
+
+
+detail::log_record* async_logger::claim(detail::log_ring* ring, uint64_t head)
+{
+  const uint64_t capacity = ring->mask + 1;
+
+  if (m_stopping.load()) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  while (head - ring->cached_tail == capacity) {
+    ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+    if (head - ring->cached_tail < capacity)
+      break;
+
+    if (m_overflow == overflow_policy::drop ||
+        m_stopping.load(std::memory_order_relaxed)) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    std::this_thread::yield();
+  }
+
+  return &ring->slots[head & ring->mask];
+}
+
+
+void async_logger::run()
+{
+  static const size_t flush_threshold = 1 << 16;
+
+  std::vector<std::shared_ptr<detail::log_ring>> rings;
+
+  for (;;) {
+    bool stopping = m_stopping.load();
+
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      if (m_rings_changed) {
+        rings = m_rings;
+        m_rings_changed = false;
+      }
+    }
+
+    size_t count = 0;
+    for (auto& ring : rings) {
+      count += drain(*ring);
+      if (m_out.size() >= flush_threshold)
+        write_out();
+    }
+
+    /* free the rings of exited threads, once empty */
+    bool retired = false;
+    for (auto& ring : rings)
+      if (ring->retired.load(std::memory_order_acquire) &&
+          ring->head.load(std::memory_order_acquire) ==
+            ring->tail.load(std::memory_order_relaxed))
+        retired = true;
+
+    if (retired) {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      auto is_done = [](const std::shared_ptr<detail::log_ring>& ring) {
+        return ring->retired.load(std::memory_order_acquire) &&
+               ring->head.load(std::memory_order_acquire) ==
+                 ring->tail.load(std::memory_order_relaxed);
+      };
+      m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(), is_done),
+                    m_rings.end());
+      rings = m_rings;
+      m_rings_changed = false;
+    }
+
+    if (count == 0) {
+      if (stopping) {
+        drain_final();
+        break;
+      }
+      write_out();
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait_for(lock, std::chrono::milliseconds(1), [this]() {
+        return m_stopping.load(std::memory_order_relaxed);
+      });
+    }
+  }
+}
+
+
+size_t async_logger::drain(detail::log_ring& ring)
+{
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  const uint64_t head = ring.head.load(std::memory_order_acquire);
+  const size_t count = head - tail;
+
+  for (; tail != head; ++tail)
+    format(ring.slots[tail & ring.mask]);
+
+  ring.tail.store(tail, std::memory_order_release);
+  return count;
+}
+
+
+/* Once stopping: wait for producers still inside log(), which claimed a
+ * slot before seeing m_stopping, and drain what they published.  The ring
+ * list is refreshed, since a thread may have registered its ring after the
+ * last copy. */
+void async_logger::drain_final()
+{
+  std::vector<std::shared_ptr<detail::log_ring>> rings;
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    rings = m_rings;
+  }
+
+  for (auto& ring : rings) {
+    while (ring->writing.load())
+      std::this_thread::yield();
+    drain(*ring);
+  }
+
+  write_out();
+}
+
+
+void async_logger::format(const detail::log_record& rec)
+{
+  char buf[32];
+
+  /* the local time formatting is redone only when the second changes; the
+   * sub-second digits are appended here */
+  int64_t second = rec.time / 1000000000LL;
+  int64_t nanos = rec.time % 1000000000LL;
+  if (nanos < 0) {
+    second -= 1;
+    nanos += 1000000000LL;
+  }
+
+  if (second != m_cached_second) {
+    std::string ts = local_timestamp(second * 1000000000LL);
+    m_cached_prefix = ts.substr(0, ts.find('.'));
+    m_cached_second = second;
+  }
+
+  m_out += m_cached_prefix;
+  snprintf(buf, sizeof buf, ".%06d ", (int)(nanos / 1000));
+  m_out += buf;
+  m_out += level_name(rec.level);
+  m_out += ' ';
+
+  size_t arg = 0;
+  for (const char* p = rec.format; *p; p++) {
+    if (p[0] == '{' && p[1] == '}' && arg < rec.nargs) {
+      const detail::log_record::arg_value& v = rec.values[arg];
+      switch (rec.types[arg]) {
+        case detail::log_record::signed_int:
+          snprintf(buf, sizeof buf, "%lld", (long long)v.i);
+          m_out += buf;
+          break;
+        case detail::log_record::unsigned_int:
+          snprintf(buf, sizeof buf, "%llu", (unsigned long long)v.u);
+          m_out += buf;
+          break;
+        case detail::log_record::real:
+          snprintf(buf, sizeof buf, "%g", v.d);
+          m_out += buf;
+          break;
+        case detail::log_record::text_span:
+          m_out.append(rec.text + v.span.offset, v.span.len);
+          break;
+      }
+      arg++;
+      p++;
+    }
+    else
+      m_out += *p;
+  }
+
+  m_out += '\n';
+}
+
+
+void async_logger::write_out()
+{
+  if (m_out.empty())
+    return;
+
+  fwrite(m_out.data(), 1, m_out.size(), m_file);
+  fflush(m_file);
+  m_out.clear();
+}
+
+}
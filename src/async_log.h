@@ -0,0 +1,242 @@
+#ifndef XXX_ASYNC_LOG_H
+#define XXX_ASYNC_LOG_H
+
+#include "utils.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace xxx
+{
+
+enum class log_level : uint8_t { trace, debug, info, warn, error };
+
+/* What a producer does when its ring buffer is full */
+enum class overflow_policy { drop, block };
+
+namespace detail
+{
+
+/* One log call, as captured on the producer thread.  Arguments are stored
+ * in binary; string arguments are copied into 'text', and truncated if it
+ * runs out. */
+struct log_record
+{
+  static const size_t max_args = 8;
+
+  enum arg_type : uint8_t { signed_int, unsigned_int, real, text_span };
+
+  union arg_value
+  {
+    int64_t i;
+    uint64_t u;
+    double d;
+    struct { uint16_t offset, len; } span;
+  };
+
+  epoch_nanos time;
+  const char* format;
+  log_level level;
+  uint8_t nargs;
+  arg_type types[max_args];
+  arg_value values[max_args];
+  char text[160];
+};
+
+/* Single producer, single consumer ring of log records, one per producer
+ * thread.  head and writing are written only by the producer, tail only by
+ * the logger thread; each side sits on its own cache line. */
+struct log_ring
+{
+  explicit log_ring(size_t capacity);
+
+  std::unique_ptr<log_record[]> slots;
+  const uint64_t mask;
+
+  alignas(64) std::atomic<uint64_t> head;
+  uint64_t cached_tail; /* producer's last view of tail */
+  std::atomic<bool> writing; /* producer is inside log() */
+
+  alignas(64) std::atomic<uint64_t> tail;
+
+  alignas(64) std::atomic<bool> retired; /* producer thread has exited */
+};
+
+} // namespace detail
+
+
+/* Asynchronous logger.
+ *
+ * Producer threads capture a timestamp, the format pointer and the raw
+ * arguments into a per-thread lock-free ring buffer; a background thread
+ * does all formatting, including the local_timestamp, and writes to the
+ * file in large batches.  Memory is bounded by ring_slots records per
+ * producer thread.  When a ring is full the record is either dropped
+ * (counted in dropped()) or the producer spins until there is room,
+ * according to the overflow policy.
+ *
+ * The format string must outlive the logger, so in practice should be a
+ * literal.  Each "{}" in it is replaced by the next argument.  Arguments may
+ * be integers, floating point, or strings (const char*, std::string,
+ * string_view), up to log_record::max_args of them.
+ *
+ * stop(), also called by the destructor, drains every ring, flushes and
+ * closes the file.  Every record is either written or counted in dropped():
+ * a record whose log() call began before stop() is written, and one logged
+ * after stop() has begun is dropped. */
+class async_logger
+{
+public:
+  struct options
+  {
+    std::string filename;
+    size_t ring_slots = 1024; /* per producer thread, rounded up to 2^n */
+    overflow_policy overflow = overflow_policy::drop;
+    clock_type clock = clock_type::tsc;
+  };
+
+  explicit async_logger(options);
+  ~async_logger();
+
+  async_logger(const async_logger&) = delete;
+  void operator=(const async_logger&) = delete;
+
+  template <typename... Args>
+  void log(log_level level, const char* format, const Args&... args)
+  {
+    static_assert(sizeof...(Args) <= detail::log_record::max_args,
+                  "too many log arguments");
+
+    detail::log_ring* ring = local_ring();
+
+    /* sequentially consistent, paired with the m_stopping check in claim(),
+     * so that the final drain either waits for this record or claim()
+     * sees the logger stopping */
+    ring->writing.store(true);
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (detail::log_record* rec = claim(ring, head)) {
+      rec->time = m_clock.now();
+      rec->format = format;
+      rec->level = level;
+      rec->nargs = sizeof...(Args);
+      size_t used = 0;
+      encode(*rec, used, 0, args...);
+
+      ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    ring->writing.store(false, std::memory_order_release);
+  }
+
+  /* Drain, flush and close; safe to call more than once */
+  void stop();
+
+  /* Guard that stops the logger when leaving scope */
+  scope_guard stop_guard() { return scope_guard([this]() { stop(); }); }
+
+  /* Number of records dropped because a ring was full, or the logger had
+   * stopped */
+  uint64_t dropped() const { return m_dropped.load(); }
+
+private:
+  detail::log_ring* local_ring();
+  detail::log_record* claim(detail::log_ring*, uint64_t head);
+
+  void run();
+  size_t drain(detail::log_ring&);
+  void drain_final();
+  void format(const detail::log_record&);
+  void write_out();
+
+  static void encode(detail::log_record&, size_t&, size_t) {}
+
+  template <typename T, typename... Args>
+  static void encode(detail::log_record& rec, size_t& used, size_t i,
+                     const T& arg, const Args&... rest)
+  {
+    encode_one(rec, used, i, arg);
+    encode(rec, used, i + 1, rest...);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value &&
+                                 std::is_signed<T>::value>::type
+  encode_one(detail::log_record& rec, size_t&, size_t i, T v)
+  {
+    rec.types[i] = detail::log_record::signed_int;
+    rec.values[i].i = v;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value &&
+                                 !std::is_signed<T>::value>::type
+  encode_one(detail::log_record& rec, size_t&, size_t i, T v)
+  {
+    rec.types[i] = detail::log_record::unsigned_int;
+    rec.values[i].u = v;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value>::type
+  encode_one(detail::log_record& rec, size_t&, size_t i, T v)
+  {
+    rec.types[i] = detail::log_record::real;
+    rec.values[i].d = v;
+  }
+
+  static void encode_one(detail::log_record& rec, size_t& used, size_t i,
+                         string_view s)
+  {
+    size_t len = std::min(s.size(), sizeof rec.text - used);
+    memcpy(rec.text + used, s.data(), len);
+    rec.types[i] = detail::log_record::text_span;
+    rec.values[i].span.offset = (uint16_t)used;
+    rec.values[i].span.len = (uint16_t)len;
+    used += len;
+  }
+
+  static void encode_one(detail::log_record& rec, size_t& used, size_t i,
+                         const char* s)
+  {
+    encode_one(rec, used, i, s ? string_view(s) : string_view("(null)"));
+  }
+
+  static void encode_one(detail::log_record& rec, size_t& used, size_t i,
+                         const std::string& s)
+  {
+    encode_one(rec, used, i, string_view(s));
+  }
+
+  const uint64_t m_id; /* distinguishes loggers in the per-thread cache */
+  const size_t m_ring_slots;
+  const overflow_policy m_overflow;
+  clock_source m_clock;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::vector<std::shared_ptr<detail::log_ring>> m_rings;
+  bool m_rings_changed;
+
+  std::atomic<bool> m_stopping;
+  std::atomic<uint64_t> m_dropped;
+
+  /* used only by the logger thread */
+  FILE* m_file;
+  std::string m_out;
+  int64_t m_cached_second;
+  std::string m_cached_prefix;
+
+  std::thread m_thread;
+  std::once_flag m_stopped;
+};
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+#include "clock.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <time.h>
+#else
+#include <windows.h>
+#endif
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define XXX_HAS_TSC 1
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace xxx
+{
+
+constexpr epoch_nanos clock_source::default_resync_interval;
+
+static constexpr epoch_nanos nanos_per_sec = 1000000000LL;
+
+#ifndef _WIN32
+static inline epoch_nanos read_clock(clockid_t id) noexcept
+{
+  timespec ts;
+  clock_gettime(id, &ts);
+  return (epoch_nanos)ts.tv_sec * nanos_per_sec + ts.tv_nsec;
+}
+#endif
+
+
+epoch_nanos wall_clock_now() noexcept
+{
+#ifndef _WIN32
+  return read_clock(CLOCK_REALTIME);
+#else
+  /* FILETIME is 100ns intervals since 1601-01-01 */
+  FILETIME ft;
+  GetSystemTimeAsFileTime(&ft);
+  uint64_t tt = ft.dwHighDateTime;
+  tt <<= 32;
+  tt |= ft.dwLowDateTime;
+  tt -= 116444736000000000ULL;
+  return (epoch_nanos)tt * 100;
+#endif
+}
+
+
+static epoch_nanos monotonic_now() noexcept
+{
+#ifndef _WIN32
+  return read_clock(CLOCK_MONOTONIC);
+#else
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (epoch_nanos)(count.QuadPart / freq.QuadPart) * nanos_per_sec +
+         (count.QuadPart % freq.QuadPart) * nanos_per_sec / freq.QuadPart;
+#endif
+}
+
+
+#ifdef XXX_HAS_TSC
+static inline uint64_t read_tsc() noexcept { return __rdtsc(); }
+#else
+static inline uint64_t read_tsc() noexcept { return 0; }
+#endif
+
+
+/* Take a tsc sample bracketing a read of 'clk', so the two are paired as
+ * closely as possible. */
+template <typename F>
+static void paired_sample(F clk, uint64_t& tsc, epoch_nanos& ns) noexcept
+{
+  uint64_t before = read_tsc();
+  ns = clk();
+  uint64_t after = read_tsc();
+  tsc = before + (after - before) / 2;
+}
+
+
+bool clock_source::tsc_supported() noexcept
+{
+#ifdef XXX_HAS_TSC
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+      eax < 0x80000007)
+    return false;
+
+  /* invariant TSC: constant rate across P-, C- and T-states */
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+
+clock_source::clock_source(clock_type type, epoch_nanos resync_interval)
+  : m_type(type),
+    m_monotonic_offset(0),
+    m_seq(0),
+    m_base_tsc(0),
+    m_base_ns(0),
+    m_mult(0),
+    m_rate_tsc(0),
+    m_rate_ns(0),
+    m_resync_ticks(0)
+{
+  m_resyncing.clear();
+
+  if (resync_interval <= 0)
+    throw std::runtime_error("clock resync interval must be positive");
+
+  if (m_type == clock_type::monotonic)
+    m_monotonic_offset = wall_clock_now() - monotonic_now();
+
+  if (m_type == clock_type::tsc) {
+    if (tsc_supported()) {
+      tsc_calibrate();
+#ifdef XXX_HAS_TSC
+      /* in 128 bits, since the interval may exceed 2^32 ns; clamp to the
+       * signed range tsc_now compares against */
+      unsigned __int128 ticks =
+        ((unsigned __int128)resync_interval << 32) / m_mult.load();
+      m_resync_ticks = (uint64_t)std::min<unsigned __int128>(ticks, INT64_MAX);
+#endif
+    }
+    else
+      m_type = clock_type::realtime;
+  }
+}
+
+
+void clock_source::tsc_calibrate()
+{
+  static constexpr epoch_nanos window = 10000000; // 10 ms
+
+  uint64_t tsc_end;
+  epoch_nanos ns_end;
+
+  paired_sample(monotonic_now, m_rate_tsc, m_rate_ns);
+  do {
+    paired_sample(monotonic_now, tsc_end, ns_end);
+  } while (ns_end - m_rate_ns < window);
+
+  m_mult = ((uint64_t)(ns_end - m_rate_ns) << 32) / (tsc_end - m_rate_tsc);
+
+  uint64_t tsc;
+  epoch_nanos ns;
+  paired_sample(wall_clock_now, tsc, ns);
+  m_base_tsc = tsc;
+  m_base_ns = ns;
+}
+
+
+/* Re-anchor to the wall clock, and refine the rate over the full interval
+ * since calibration.  Caller must hold m_resyncing. */
+void clock_source::tsc_resync() const noexcept
+{
+#ifdef XXX_HAS_TSC
+  uint64_t rate_tsc;
+  epoch_nanos rate_ns;
+  paired_sample(monotonic_now, rate_tsc, rate_ns);
+
+  uint64_t mult = m_mult.load(std::memory_order_relaxed);
+  if (rate_tsc > m_rate_tsc && rate_ns > m_rate_ns)
+    mult = (uint64_t)(((unsigned __int128)(rate_ns - m_rate_ns) << 32) /
+                      (rate_tsc - m_rate_tsc));
+
+  uint64_t tsc;
+  epoch_nanos ns;
+  paired_sample(wall_clock_now, tsc, ns);
+
+  uint32_t seq = m_seq.load(std::memory_order_relaxed);
+  m_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_base_tsc.store(tsc, std::memory_order_relaxed);
+  m_base_ns.store(ns, std::memory_order_relaxed);
+  m_mult.store(mult, std::memory_order_relaxed);
+  m_seq.store(seq + 2, std::memory_order_release);
+#endif
+}
+
+
+epoch_nanos clock_source::tsc_now() const noexcept
+{
+#ifdef XXX_HAS_TSC
+  uint64_t tsc = read_tsc();
+  uint64_t base_tsc, mult;
+  epoch_nanos base_ns;
+  uint32_t seq;
+
+  do {
+    seq = m_seq.load(std::memory_order_acquire);
+    base_tsc = m_base_tsc.load(std::memory_order_relaxed);
+    base_ns = m_base_ns.load(std::memory_order_relaxed);
+    mult = m_mult.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+
+  /* signed, because another core may read a tsc a little behind the anchor */
+  int64_t delta = (int64_t)(tsc - base_tsc);
+
+  if (delta > (int64_t)m_resync_ticks &&
+      !m_resyncing.test_and_set(std::memory_order_acquire)) {
+    tsc_resync();
+    m_resyncing.clear(std::memory_order_release);
+  }
+
+  return base_ns + (epoch_nanos)(((__int128)delta * mult) >> 32);
+#else
+  return wall_clock_now();
+#endif
+}
+
+
+epoch_nanos clock_source::now() const noexcept
+{
+  switch (m_type) {
+    case clock_type::realtime:
+      return wall_clock_now();
+    case clock_type::realtime_coarse:
+#if defined(CLOCK_REALTIME_COARSE)
+      return read_clock(CLOCK_REALTIME_COARSE);
+#else
+      return wall_clock_now();
+#endif
+    case clock_type::monotonic:
+      return monotonic_now() + m_monotonic_offset;
+    case clock_type::tsc:
+      return tsc_now();
+  };
+
+  return wall_clock_now();
+}
+
+}
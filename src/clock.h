@@ -0,0 +1,79 @@
+#ifndef XXX_CLOCK_H
+#define XXX_CLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace xxx
+{
+
+/* Nanoseconds since the unix epoch, 1970-01-01T00:00:00Z */
+typedef int64_t epoch_nanos;
+
+enum class clock_type
+{
+  realtime,        /* clock_gettime(CLOCK_REALTIME) */
+  realtime_coarse, /* CLOCK_REALTIME_COARSE; cheapest, resolution of a tick */
+  monotonic,       /* CLOCK_MONOTONIC, anchored to wall time at construction */
+  tsc              /* calibrated rdtsc, periodically re-synced to wall time */
+};
+
+/* Source of nanosecond wall-clock timestamps.
+ *
+ * All clock types return time since the epoch, so values taken from any of
+ * them can be passed to the timestamp formatters.  The monotonic clock is
+ * anchored to the wall clock once, when constructed, and afterwards does not
+ * follow wall clock adjustments.  The tsc clock converts the CPU timestamp
+ * counter to nanoseconds using a rate calibrated at construction, and every
+ * resync_interval it re-anchors itself to CLOCK_REALTIME and refines the
+ * rate.  If the CPU has no invariant TSC, the tsc type falls back to
+ * realtime; check type() for the clock actually in use.  Throws
+ * std::runtime_error if resync_interval is not positive.
+ *
+ * now() is safe to call concurrently from multiple threads. */
+class clock_source
+{
+public:
+  static constexpr epoch_nanos default_resync_interval = 1000000000; // 1 sec
+
+  explicit clock_source(clock_type = clock_type::realtime,
+                        epoch_nanos resync_interval = default_resync_interval);
+
+  clock_source(const clock_source&) = delete;
+  void operator=(const clock_source&) = delete;
+
+  epoch_nanos now() const noexcept;
+
+  clock_type type() const noexcept { return m_type; }
+
+  /* Return true if the CPU has an invariant timestamp counter */
+  static bool tsc_supported() noexcept;
+
+private:
+  epoch_nanos tsc_now() const noexcept;
+  void tsc_calibrate();
+  void tsc_resync() const noexcept;
+
+  clock_type m_type;
+  epoch_nanos m_monotonic_offset;
+
+  /* tsc conversion, ns = base_ns + ((tsc - base_tsc) * mult) >> 32; guarded
+   * by a sequence lock so readers never see a torn update */
+  mutable std::atomic<uint32_t> m_seq;
+  mutable std::atomic<uint64_t> m_base_tsc;
+  mutable std::atomic<int64_t> m_base_ns;
+  mutable std::atomic<uint64_t> m_mult;
+  mutable std::atomic_flag m_resyncing;
+
+  /* only accessed by the thread holding m_resyncing */
+  mutable uint64_t m_rate_tsc;
+  mutable int64_t m_rate_ns;
+  uint64_t m_resync_ticks;
+};
+
+/* Current wall clock time, nanosecond resolution */
+epoch_nanos wall_clock_now() noexcept;
+
+}
+
+#endif
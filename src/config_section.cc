@@ -5,6 +5,13 @@
 #include <iostream>
 #include <algorithm>
 #include <regex>
+#include <sstream>
+
+#ifdef _WIN32
+#define environ _environ
+#else
+extern char** environ;
+#endif
 
 namespace xxx {
 
@@ -71,9 +78,43 @@ struct ini_handler_context {
   config_section * root;
   std::string env;
   int instance;
+  const std::map<std::string, std::string>* variables; /* if interpolating */
 };
 
 
+/* Replace each ${VAR} in 'value' */
+static std::string interpolate(const std::string& value,
+                               const std::map<std::string, std::string>& vars)
+{
+  std::string rv;
+  size_t pos = 0;
+
+  for (;;) {
+    size_t start = value.find("${", pos);
+    if (start == std::string::npos)
+      break;
+
+    size_t end = value.find('}', start + 2);
+    if (end == std::string::npos)
+      throw config_error("unterminated ${ in value");
+
+    std::string name = value.substr(start + 2, end - start - 2);
+    auto iter = vars.find(name);
+    if (iter == vars.end())
+      throw config_error("environment variable '" + name + "' not defined");
+
+    rv.append(value, pos, start - pos);
+    rv += iter->second;
+    pos = end + 1;
+  }
+
+  if (pos == 0)
+    return value;
+  rv.append(value, pos, std::string::npos);
+  return rv;
+}
+
+
 static int ini_handler(void* user, const char* section, const char* name,
                        const char* value)
 {
@@ -112,7 +153,11 @@ static int ini_handler(void* user, const char* section, const char* name,
     if (key.instid && context->instance != key.instid.value())
       return 1;
 
-    confsection->add(std::move(key), value);
+    if (context->variables)
+      confsection->add(std::move(key),
+                       interpolate(value, *context->variables));
+    else
+      confsection->add(std::move(key), value);
   }
   catch (const config_error& e) {
     std::ostringstream os;
@@ -144,19 +189,70 @@ static void auto_key(ini_handler_context& context,
   }
 }
 
-config_section config_section::parse_ini_file(const std::string& filename,
-                                              const std::string& env,
-                                              int instance)
+/* Apply the variables starting with 'prefix' over the loaded config */
+static void apply_overlay(config_section& root, const std::string& prefix,
+                          const std::map<std::string, std::string>& vars)
+{
+  for (auto iter = vars.lower_bound(prefix);
+       iter != vars.end() && iter->first.compare(0, prefix.size(), prefix) == 0;
+       ++iter) {
+    std::string rest = iter->first.substr(prefix.size());
+    size_t sep = rest.find("__");
+
+    std::string section;
+    std::string name = rest;
+    if (sep != std::string::npos) {
+      section = rest.substr(0, sep);
+      name = rest.substr(sep + 2);
+    }
+    if (name.empty() || (sep != std::string::npos && section.empty()))
+      throw config_error("invalid config overlay variable '" + iter->first + "'");
+
+    config_section* target = &root;
+    if (!section.empty()) {
+      if (!root.has_section(section))
+        root.add({section});
+      target = &root.get_last_section(section);
+    }
+    else if (name == "env" || name == "instance") {
+      std::ostringstream os;
+      os << "cannot override auto key '" << name << "' from variable '"
+         << iter->first << "'";
+      throw config_error(os.str());
+    }
+
+    target->add_overlay(std::move(name), iter->second);
+  }
+}
+
+
+static config_section load_ini_file(const std::string& filename,
+                                    const std::string& env,
+                                    int instance,
+                                    const env_overlay* overlay)
 {
   config_section cfg("root");
 
   if (env.empty())
     throw config_error("env cannot be empty");
 
+  /* the environment is read here only, never after loading */
+  std::map<std::string, std::string> snapshot;
+  const std::map<std::string, std::string>* vars = nullptr;
+  if (overlay) {
+    if (overlay->variables)
+      vars = &overlay->variables.value();
+    else {
+      snapshot = environment_snapshot();
+      vars = &snapshot;
+    }
+  }
+
   ini_handler_context context;
   context.root = &cfg;
   context.env = env;
   context.instance=instance;
+  context.variables = (overlay && overlay->interpolate) ? vars : nullptr;
 
   if (context.env.empty())
     throw config_error("config environment cannot be empty");
@@ -166,9 +262,42 @@ config_section config_section::parse_ini_file(const std::string& filename,
 
   auto_key(context, "env", context.env);
   auto_key(context, "instance", std::to_string(context.instance));
+
+  if (overlay && !overlay->prefix.empty())
+    apply_overlay(cfg, overlay->prefix, *vars);
+
   return cfg;
 }
 
+
+config_section config_section::parse_ini_file(const std::string& filename,
+                                              const std::string& env,
+                                              int instance)
+{
+  return load_ini_file(filename, env, instance, nullptr);
+}
+
+
+config_section config_section::parse_ini_file(const std::string& filename,
+                                              const std::string& env,
+                                              int instance,
+                                              const env_overlay& overlay)
+{
+  return load_ini_file(filename, env, instance, &overlay);
+}
+
+
+std::map<std::string, std::string> environment_snapshot()
+{
+  std::map<std::string, std::string> rv;
+  for (char** p = environ; p && *p; ++p) {
+    const char* eq = strchr(*p, '=');
+    if (eq)
+      rv.emplace(std::string(*p, eq - *p), std::string(eq + 1));
+  }
+  return rv;
+}
+
 config_section::config_section(std::string name)
   : m_name(std::move(name))
 {
@@ -208,11 +337,12 @@ void config_section::add(config_key key, std::string value)
   auto iter = m_items.find(key.name);
 
   if (iter == m_items.end()) {
-    m_items[key.name] = {std::move(key), std::move(value)};
+    std::string name = key.name; /* key is moved from below */
+    m_items[name] = {std::move(key), std::move(value), false};
   }
   else
   {
-    const int exist_score = iter->second.key.precision_score();
+    const int exist_score = iter->second.precision_score();
     if (key.precision_score() > exist_score) {
       iter->second.key = std::move(key);
       iter->second.value = std::move(value);
@@ -223,6 +353,15 @@ void config_section::add(config_key key, std::string value)
 
 }
 
+void config_section::add_overlay(std::string name, std::string value)
+{
+  config_item& item = m_items[name];
+  item.key = config_key();
+  item.key.name = std::move(name);
+  item.value = std::move(value);
+  item.overlay = true;
+}
+
 void config_section::add(config_section cs)
 {
   m_sections.push_back( std::move(cs) );
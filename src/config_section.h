@@ -34,8 +34,32 @@ struct config_item
 {
   config_key key;
   std::string value;
+  bool overlay; /* set from the environment */
+
+  /* Environment overlay items rank above every key of the file */
+  int precision_score() const { return overlay ? 4 : key.precision_score(); }
+};
+
+/* Environment overlay stage of parse_ini_file.
+ *
+ * The environment is read once, at load.  A variable named prefix + key
+ * sets that key of the root section, and prefix + section + "__" + key sets
+ * a key of the section, eg APP_server__port; these override any key of the
+ * file.  An empty prefix maps no variables.  If interpolate is set, each
+ * ${VAR} in a file value is replaced by the value of VAR, and an undefined
+ * VAR is an error. */
+struct env_overlay
+{
+  std::string prefix;
+  bool interpolate = true;
+
+  /* Variables to use instead of the process environment, if set */
+  maybe<std::map<std::string, std::string>> variables;
 };
 
+/* Copy of the process environment */
+std::map<std::string, std::string> environment_snapshot();
+
 struct config_error : std::runtime_error
 {
   config_error(std::string error);
@@ -73,6 +97,10 @@ public:
   /** Insert a name / value pair. Any existing pair will be overwritten.*/
   void add(config_key key, std::string value);
 
+  /** Insert a name / value pair that takes precedence over any pair
+   * inserted by add() */
+  void add_overlay(std::string name, std::string value);
+
   /** Insert a subsection */
   void add(config_section);
 
@@ -85,6 +113,11 @@ public:
                                        const std::string& env,
                                        int instance);
 
+  static config_section parse_ini_file(const std::string& filename,
+                                       const std::string& env,
+                                       int instance,
+                                       const env_overlay& overlay);
+
 private:
 
   std::string m_name;
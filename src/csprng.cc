@@ -0,0 +1,318 @@
+#include "csprng.h"
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace xxx
+{
+
+namespace
+{
+
+const size_t lanes = 8;
+const size_t block_bytes = 64;
+const size_t buffer_bytes = lanes * block_bytes;
+const size_t key_words = 8;
+const size_t key_bytes = key_words * 4;
+const size_t group_bytes = 32; /* bytes mapped per step of random_ascii_fill */
+
+struct chacha_state
+{
+  uint32_t key[key_words];
+  unsigned char buf[buffer_bytes];
+  size_t pos;          /* next unread byte of buf */
+  unsigned generation; /* fork generation when seeded, 0 if never */
+};
+
+thread_local chacha_state tls_state;
+
+/* Bumped in the child after fork, so each thread state knows to reseed */
+std::atomic<unsigned> fork_generation(1);
+
+#ifndef _WIN32
+void on_fork_child()
+{
+  fork_generation.fetch_add(1);
+}
+#endif
+
+
+inline uint32_t rotl(uint32_t v, int n)
+{
+  return (v << n) | (v >> (32 - n));
+}
+
+
+/* One ChaCha quarter round applied across all lanes; written lane-wise so
+ * the compiler maps each statement onto vector instructions. */
+inline void quarter_round(uint32_t (&x)[16][lanes], int a, int b, int c, int d)
+{
+  for (size_t l = 0; l < lanes; l++) {
+    x[a][l] += x[b][l]; x[d][l] = rotl(x[d][l] ^ x[a][l], 16);
+    x[c][l] += x[d][l]; x[b][l] = rotl(x[b][l] ^ x[c][l], 12);
+    x[a][l] += x[b][l]; x[d][l] = rotl(x[d][l] ^ x[a][l], 8);
+    x[c][l] += x[d][l]; x[b][l] = rotl(x[b][l] ^ x[c][l], 7);
+  }
+}
+
+
+/* Generate 'lanes' consecutive ChaCha20 blocks, starting at block 0 with a
+ * zero nonce; every key is used for a single call. */
+void chacha20_blocks(const uint32_t (&key)[key_words], unsigned char* out)
+{
+  uint32_t in[16][lanes];
+  uint32_t x[16][lanes];
+
+  for (size_t l = 0; l < lanes; l++) {
+    in[0][l] = 0x61707865;
+    in[1][l] = 0x3320646e;
+    in[2][l] = 0x79622d32;
+    in[3][l] = 0x6b206574;
+    for (size_t i = 0; i < key_words; i++)
+      in[4 + i][l] = key[i];
+    in[12][l] = (uint32_t)l;
+    in[13][l] = 0;
+    in[14][l] = 0;
+    in[15][l] = 0;
+  }
+
+  memcpy(x, in, sizeof x);
+
+  for (int round = 0; round < 10; round++) {
+    quarter_round(x, 0, 4, 8, 12);
+    quarter_round(x, 1, 5, 9, 13);
+    quarter_round(x, 2, 6, 10, 14);
+    quarter_round(x, 3, 7, 11, 15);
+    quarter_round(x, 0, 5, 10, 15);
+    quarter_round(x, 1, 6, 11, 12);
+    quarter_round(x, 2, 7, 8, 13);
+    quarter_round(x, 3, 4, 9, 14);
+  }
+
+  for (size_t l = 0; l < lanes; l++)
+    for (size_t i = 0; i < 16; i++) {
+      uint32_t v = x[i][l] + in[i][l];
+      unsigned char* p = out + l * block_bytes + i * 4;
+      p[0] = (unsigned char)v;
+      p[1] = (unsigned char)(v >> 8);
+      p[2] = (unsigned char)(v >> 16);
+      p[3] = (unsigned char)(v >> 24);
+    }
+
+  memset(x, 0, sizeof x);
+  memset(in, 0, sizeof in);
+}
+
+
+void os_random(void* dest, size_t len)
+{
+  unsigned char* p = (unsigned char*)dest;
+
+#if defined(__linux__) && defined(SYS_getrandom)
+  while (len) {
+    long rc = syscall(SYS_getrandom, p, len, 0);
+    if (rc > 0) {
+      p += rc;
+      len -= rc;
+    }
+    else if (rc < 0 && errno == EINTR)
+      continue;
+    else if (rc < 0 && errno == ENOSYS)
+      break; /* old kernel; use the fallback below */
+    else
+      throw std::runtime_error("getrandom failed");
+  }
+#endif
+
+  if (len) {
+    std::random_device rd;
+    while (len) {
+      unsigned int v = rd();
+      size_t n = len < sizeof v ? len : sizeof v;
+      memcpy(p, &v, n);
+      p += n;
+      len -= n;
+    }
+  }
+}
+
+
+void seed(chacha_state& st, unsigned generation)
+{
+#ifndef _WIN32
+  static std::once_flag registered;
+  std::call_once(registered, [] { pthread_atfork(nullptr, nullptr, on_fork_child); });
+#endif
+
+  unsigned char raw[key_bytes];
+  os_random(raw, sizeof raw);
+  memcpy(st.key, raw, sizeof st.key);
+  memset(raw, 0, sizeof raw);
+
+  memset(st.buf, 0, sizeof st.buf);
+  st.pos = buffer_bytes;
+  st.generation = generation;
+}
+
+
+/* Refill the buffer, then replace the key with its first bytes */
+void refill(chacha_state& st)
+{
+  chacha20_blocks(st.key, st.buf);
+  memcpy(st.key, st.buf, key_bytes);
+  memset(st.buf, 0, key_bytes);
+  st.pos = key_bytes;
+}
+
+
+/* Return up to 'want' unread bytes of the thread's buffer, via 'p'.  The
+ * caller must consume and then wipe them. */
+size_t take(size_t want, unsigned char*& p)
+{
+  chacha_state& st = tls_state;
+
+  unsigned generation = fork_generation.load(std::memory_order_relaxed);
+  if (st.generation != generation)
+    seed(st, generation);
+
+  if (st.pos == buffer_bytes)
+    refill(st);
+
+  size_t n = buffer_bytes - st.pos;
+  if (n > want)
+    n = want;
+
+  p = st.buf + st.pos;
+  st.pos += n;
+  return n;
+}
+
+
+/* Branch free, so loops over whole buffers vectorize */
+inline char hex_digit(unsigned int v)
+{
+  return (char)(v + (v > 9 ? 'a' - 10 : '0'));
+}
+
+} // namespace
+
+
+void detail::chacha20_blocks(const uint32_t (&key)[8], unsigned char* out)
+{
+  static_assert(detail::chacha20_lanes == lanes, "lane count mismatch");
+  ::xxx::chacha20_blocks(key, out);
+}
+
+
+void random_bytes(void* dest, size_t len)
+{
+  unsigned char* out = (unsigned char*)dest;
+  unsigned char* p;
+
+  while (len) {
+    size_t n = take(len, p);
+    memcpy(out, p, n);
+    memset(p, 0, n);
+    out += n;
+    len -= n;
+  }
+}
+
+
+uint64_t random_uint64()
+{
+  uint64_t v;
+  random_bytes(&v, sizeof v);
+  return v;
+}
+
+
+void random_ascii_fill(char* dest, size_t len)
+{
+  /* 94 printables; bytes at or above 2*94 are rejected, to avoid bias */
+  static const unsigned char count = '~' - '!' + 1;
+  static const unsigned char limit = 2 * count;
+
+  unsigned char* p;
+  unsigned char in[group_bytes];
+  unsigned char chars[group_bytes];
+  unsigned char keep[group_bytes];
+  char out[group_bytes];
+
+  while (len) {
+    /* accepted with probability 188/256; ask for about what is needed */
+    size_t n = take(len + len / 3 + 1, p);
+
+    for (size_t i = 0; i < n && len; i += group_bytes) {
+      size_t m = n - i < group_bytes ? n - i : group_bytes;
+      memcpy(in, p + i, m);
+      memset(in + m, 0, group_bytes - m);
+
+      /* Map and mark a whole group; compare, select and add only, so the
+       * compiler turns this into vector instructions. */
+      for (size_t j = 0; j < group_bytes; j++) {
+        unsigned char b = in[j];
+        chars[j] = (unsigned char)(b - (b >= count ? count : 0) + '!');
+        keep[j] = b < limit;
+      }
+
+      /* Pack the accepted characters, without branches */
+      size_t k = 0;
+      for (size_t j = 0; j < m; j++) {
+        out[k] = (char)chars[j];
+        k += keep[j];
+      }
+
+      if (k > len)
+        k = len;
+      memcpy(dest, out, k);
+      dest += k;
+      len -= k;
+    }
+
+    memset(p, 0, n);
+  }
+
+  memset(in, 0, sizeof in);
+  memset(chars, 0, sizeof chars);
+  memset(keep, 0, sizeof keep);
+  memset(out, 0, sizeof out);
+}
+
+
+void random_hex_fill(char* dest, size_t len)
+{
+  unsigned char* p;
+
+  while (len > 1) {
+    size_t n = take(len / 2, p);
+    for (size_t i = 0; i < n; i++) {
+      dest[2 * i] = hex_digit(p[i] >> 4);
+      dest[2 * i + 1] = hex_digit(p[i] & 0xF);
+    }
+    memset(p, 0, n);
+    dest += 2 * n;
+    len -= 2 * n;
+  }
+
+  if (len) {
+    take(1, p);
+    *dest = hex_digit(p[0] >> 4);
+    p[0] = 0;
+  }
+}
+
+}
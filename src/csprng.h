@@ -0,0 +1,51 @@
+#ifndef XXX_CSPRNG_H
+#define XXX_CSPRNG_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xxx
+{
+
+/* Cryptographically secure random numbers.
+ *
+ * Each thread owns a ChaCha20 generator, seeded once from the operating
+ * system (getrandom on Linux) on first use, and reseeded in the child after
+ * fork.  Output is generated eight blocks at a time into a per-thread
+ * buffer, and the key is replaced from each buffer's first 32 bytes (fast
+ * key erasure), so earlier output cannot be recovered from a later state.
+ * Bytes are wiped from the buffer as they are handed out.
+ *
+ * None of these functions lock, and all are safe to call from any thread. */
+
+/* Fill 'dest' with 'len' random bytes */
+void random_bytes(void* dest, size_t len);
+
+/* Uniformly distributed random 64 bit value */
+uint64_t random_uint64();
+
+/* Fill 'dest' with 'len' characters uniformly drawn from the ascii
+ * printables, '!' to '~'.  Generator output is mapped 32 bytes at a time,
+ * rejecting bytes that would bias the draw; about 1.36 bytes are used per
+ * character. */
+void random_ascii_fill(char* dest, size_t len);
+
+/* Fill 'dest' with 'len' random lower case hex digits, two per generator
+ * byte */
+void random_hex_fill(char* dest, size_t len);
+
+namespace detail
+{
+
+const size_t chacha20_lanes = 8;
+
+/* The generator's block function, exposed for known-answer checks: writes
+ * chacha20_lanes consecutive 64 byte ChaCha20 blocks, for counters 0, 1,
+ * ..., with a zero nonce and the key words loaded little endian. */
+void chacha20_blocks(const uint32_t (&key)[8], unsigned char* out);
+
+}
+
+}
+
+#endif
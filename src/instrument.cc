@@ -0,0 +1,257 @@
+#include "instrument.h"
+
+#ifdef XXX_ENABLE_INSTRUMENTATION
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace xxx
+{
+
+static const char* probe_name(probe p)
+{
+  switch (p) {
+    case probe::salted_password: return "salted_password";
+    case probe::hmac_sha256: return "hmac_sha256";
+    case probe::random_ascii_string: return "random_ascii_string";
+    case probe::random_hex_nonce: return "random_hex_nonce";
+    case probe::count: break;
+  };
+  return "";
+}
+
+
+#ifdef XXX_ENABLE_INSTRUMENTATION
+
+namespace
+{
+
+const size_t probe_count = (size_t)probe::count;
+
+/* Values below 32 have a bucket each; above, each power of two is split in
+ * 16 sub-buckets.  The largest bucket covers up to 2^41 ns; longer calls
+ * are counted there. */
+const int sub_bits = 4;
+const int max_shift = 36;
+const size_t bucket_count = (max_shift + 1) * 16 + 16;
+
+inline size_t bucket_of(uint64_t v)
+{
+  if (v < 32)
+    return (size_t)v;
+
+  int shift = (63 - __builtin_clzll(v)) - sub_bits;
+  if (shift > max_shift)
+    return bucket_count - 1;
+  return (size_t)(shift * 16 + (v >> shift));
+}
+
+/* Highest value counted in bucket 'b' */
+inline uint64_t bucket_high(size_t b)
+{
+  if (b < 32)
+    return b;
+
+  int shift = (int)(b >> sub_bits) - 1;
+  uint64_t mantissa = (b & 15) + 16;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+
+/* Counters are written only by their owning thread, so a plain load and
+ * store suffices, avoiding a locked read-modify-write.  Readers may see a
+ * snapshot that is a few calls stale. */
+inline void bump(std::atomic<uint64_t>& c, uint64_t by = 1)
+{
+  c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+struct probe_stats
+{
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> total_ns;
+  std::atomic<uint64_t> max_ns;
+  std::atomic<uint64_t> buckets[bucket_count];
+
+  probe_stats() : calls(0), errors(0), total_ns(0), max_ns(0)
+  {
+    for (auto& b : buckets)
+      b.store(0, std::memory_order_relaxed);
+  }
+};
+
+struct thread_stats
+{
+  probe_stats probes[probe_count];
+};
+
+/* Plain totals, used for merging */
+struct probe_totals
+{
+  uint64_t calls = 0;
+  uint64_t errors = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(bucket_count, 0);
+
+  void add(const probe_stats& s)
+  {
+    calls += s.calls.load(std::memory_order_relaxed);
+    errors += s.errors.load(std::memory_order_relaxed);
+    total_ns += s.total_ns.load(std::memory_order_relaxed);
+    max_ns = std::max(max_ns, s.max_ns.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < bucket_count; i++)
+      buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+  }
+
+  void add(const probe_totals& t)
+  {
+    calls += t.calls;
+    errors += t.errors;
+    total_ns += t.total_ns;
+    max_ns = std::max(max_ns, t.max_ns);
+    for (size_t i = 0; i < bucket_count; i++)
+      buckets[i] += t.buckets[i];
+  }
+
+  uint64_t percentile(double pct) const
+  {
+    uint64_t count = 0;
+    for (auto b : buckets)
+      count += b;
+    if (count == 0)
+      return 0;
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * count);
+    if (rank >= count)
+      rank = count - 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+      seen += buckets[i];
+      if (seen > rank)
+        return std::min(bucket_high(i), max_ns);
+    }
+    return max_ns;
+  }
+};
+
+/* Registry of live thread stats, and totals of threads that have exited */
+struct registry
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<thread_stats>> live;
+  probe_totals retired[probe_count];
+};
+
+registry& the_registry()
+{
+  static registry* r = new registry; // never destroyed; used at thread exit
+  return *r;
+}
+
+struct thread_handle
+{
+  std::shared_ptr<thread_stats> stats;
+
+  thread_handle() : stats(std::make_shared<thread_stats>())
+  {
+    registry& r = the_registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    r.live.push_back(stats);
+  }
+
+  ~thread_handle()
+  {
+    registry& r = the_registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (size_t i = 0; i < probe_count; i++)
+      r.retired[i].add(stats->probes[i]);
+    for (auto iter = r.live.begin(); iter != r.live.end(); ++iter)
+      if (*iter == stats) {
+        r.live.erase(iter);
+        break;
+      }
+  }
+};
+
+thread_local thread_handle tls_handle;
+
+} // namespace
+
+
+const clock_source& instrument_clock()
+{
+  static clock_source clk(clock_type::tsc);
+  return clk;
+}
+
+
+void instrument_record(probe p, epoch_nanos nanos, bool error) noexcept
+{
+  probe_stats& s = tls_handle.stats->probes[(size_t)p];
+  uint64_t v = nanos > 0 ? (uint64_t)nanos : 0;
+
+  bump(s.calls);
+  if (error)
+    bump(s.errors);
+  bump(s.total_ns, v);
+  if (v > s.max_ns.load(std::memory_order_relaxed))
+    s.max_ns.store(v, std::memory_order_relaxed);
+  bump(s.buckets[bucket_of(v)]);
+}
+
+
+wampcc::json_value instrument_snapshot()
+{
+  probe_totals totals[probe_count];
+
+  {
+    registry& r = the_registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (size_t i = 0; i < probe_count; i++) {
+      totals[i].add(r.retired[i]);
+      for (auto& ts : r.live)
+        totals[i].add(ts->probes[i]);
+    }
+  }
+
+  wampcc::json_object probes;
+  for (size_t i = 0; i < probe_count; i++) {
+    const probe_totals& t = totals[i];
+    wampcc::json_object item;
+    item["calls"] = wampcc::json_value::make_uint(t.calls);
+    item["errors"] = wampcc::json_value::make_uint(t.errors);
+    item["mean_ns"] = wampcc::json_value::make_double(
+      t.calls ? (double)t.total_ns / t.calls : 0.0);
+    item["max_ns"] = wampcc::json_value::make_uint(t.max_ns);
+    item["p50_ns"] = wampcc::json_value::make_uint(t.percentile(50));
+    item["p90_ns"] = wampcc::json_value::make_uint(t.percentile(90));
+    item["p99_ns"] = wampcc::json_value::make_uint(t.percentile(99));
+    item["p999_ns"] = wampcc::json_value::make_uint(t.percentile(99.9));
+    probes[probe_name((probe)i)] = item;
+  }
+
+  wampcc::json_object rv;
+  rv["enabled"] = wampcc::json_value::make_bool(true);
+  rv["probes"] = probes;
+  return rv;
+}
+
+#else
+
+wampcc::json_value instrument_snapshot()
+{
+  (void) probe_name;
+  wampcc::json_object rv;
+  rv["enabled"] = wampcc::json_value::make_bool(false);
+  return rv;
+}
+
+#endif
+
+}
@@ -0,0 +1,53 @@
+#include "json_args.h"
+
+namespace xxx
+{
+
+std::vector<string_view> string_views(const wampcc::json_array& ja)
+{
+  std::vector<string_view> rv;
+  rv.reserve(ja.size());
+
+  for (auto & x : ja)
+    if (x.is_string())
+      rv.push_back(x.as_string());
+
+  return rv;
+}
+
+
+size_t string_views(const wampcc::json_array& ja, string_view* out, size_t max)
+{
+  size_t n = 0;
+
+  for (auto iter = ja.begin(); iter != ja.end() && n < max; ++iter)
+    if (iter->is_string())
+      out[n++] = iter->as_string();
+
+  return n;
+}
+
+
+template <typename T>
+static extract_status convert_all(const wampcc::json_array& ja, T* out)
+{
+  for (size_t i = 0; i < ja.size(); i++)
+    if (!detail::extract_one(ja[i], out[i]))
+      return {extract_status::code::wrong_type, i};
+
+  return extract_status::ok();
+}
+
+
+extract_status int64_values(const wampcc::json_array& ja, int64_t* out)
+{
+  return convert_all(ja, out);
+}
+
+
+extract_status double_values(const wampcc::json_array& ja, double* out)
+{
+  return convert_all(ja, out);
+}
+
+}
@@ -0,0 +1,241 @@
+#ifndef XXX_JSON_ARGS_H
+#define XXX_JSON_ARGS_H
+
+#include "utils.h"
+
+#include <limits>
+#include <type_traits>
+
+namespace xxx
+{
+
+/* Helpers for pulling typed values out of the wamp argument list, without
+ * copying the array.  Where possible results are views into the array, so
+ * are valid only while it is alive and unmodified.  Type errors are reported
+ * through extract_status rather than by throwing. */
+
+struct extract_status
+{
+  enum class code { ok, too_few, wrong_type };
+
+  code status;
+  size_t index; /* position of the element that failed */
+
+  explicit operator bool() const { return status == code::ok; }
+
+  static extract_status ok() { return {code::ok, 0}; }
+};
+
+/* Views of the string elements; other elements are skipped, as for
+ * strings().  The array overload writes at most 'max' views and returns the
+ * number written. */
+std::vector<string_view> string_views(const wampcc::json_array&);
+size_t string_views(const wampcc::json_array&, string_view* out, size_t max);
+
+/* Convert every element, writing into 'out', which must have room for
+ * ja.size() values.  Integer elements convert to double; real elements do
+ * not convert to int64_t. */
+extract_status int64_values(const wampcc::json_array& ja, int64_t* out);
+extract_status double_values(const wampcc::json_array& ja, double* out);
+
+
+namespace detail
+{
+
+inline bool extract_one(const wampcc::json_value& v, int64_t& out)
+{
+  if (v.is_int())
+    out = v.as_int();
+  else if (v.is_uint() &&
+           v.as_uint() <= (uint64_t)std::numeric_limits<int64_t>::max())
+    out = (int64_t)v.as_uint();
+  else
+    return false;
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, uint64_t& out)
+{
+  if (v.is_uint())
+    out = v.as_uint();
+  else if (v.is_int() && v.as_int() >= 0)
+    out = (uint64_t)v.as_int();
+  else
+    return false;
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, int& out)
+{
+  int64_t tmp;
+  if (!extract_one(v, tmp) || tmp < std::numeric_limits<int>::min() ||
+      tmp > std::numeric_limits<int>::max())
+    return false;
+  out = (int)tmp;
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, double& out)
+{
+  if (v.is_real())
+    out = v.as_real();
+  else if (v.is_int())
+    out = (double)v.as_int();
+  else if (v.is_uint())
+    out = (double)v.as_uint();
+  else
+    return false;
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, bool& out)
+{
+  if (!v.is_bool())
+    return false;
+  out = v.as_bool();
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, string_view& out)
+{
+  if (!v.is_string())
+    return false;
+  const std::string& s = v.as_string();
+  out = string_view(s.data(), s.size());
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, const wampcc::json_value*& out)
+{
+  out = &v;
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, const wampcc::json_array*& out)
+{
+  if (!v.is_array())
+    return false;
+  out = &v.as_array();
+  return true;
+}
+
+inline bool extract_one(const wampcc::json_value& v, const wampcc::json_object*& out)
+{
+  if (!v.is_object())
+    return false;
+  out = &v.as_object();
+  return true;
+}
+
+/* std::string targets copy, unless the array is being consumed */
+inline bool extract_one(const wampcc::json_value& v, std::string& out)
+{
+  if (!v.is_string())
+    return false;
+  out = v.as_string();
+  return true;
+}
+
+inline bool extract_one(wampcc::json_value&& v, std::string& out)
+{
+  if (!v.is_string())
+    return false;
+  out = std::move(v.as_string());
+  return true;
+}
+
+template <typename V, typename T>
+bool extract_one(V&& v, maybe<T>& out)
+{
+  T tmp;
+  if (!extract_one(std::forward<V>(v), tmp))
+    return false;
+  out = std::move(tmp);
+  return true;
+}
+
+template <typename T> struct is_maybe : std::false_type {};
+template <typename T> struct is_maybe<maybe<T>> : std::true_type {};
+
+/* Targets that own their value, so may be filled from a temporary array */
+template <typename T>
+struct is_owning_target
+  : std::integral_constant<bool, std::is_arithmetic<T>::value ||
+                                   std::is_same<T, std::string>::value>
+{
+};
+template <typename T>
+struct is_owning_target<maybe<T>> : is_owning_target<T> {};
+
+template <typename... Ts> struct all_owning : std::true_type {};
+template <typename T, typename... Ts>
+struct all_owning<T, Ts...>
+  : std::integral_constant<bool, is_owning_target<T>::value &&
+                                   all_owning<Ts...>::value>
+{
+};
+
+template <typename A>
+extract_status unpack_at(A&&, size_t)
+{
+  return extract_status::ok();
+}
+
+/* 'A' is json_array& when unpacking a const array, json_array&& when the
+ * array may be consumed */
+template <typename A, typename T, typename... Ts>
+extract_status unpack_at(A&& ja, size_t i, T& out, Ts&... rest)
+{
+  typedef typename std::conditional<
+    std::is_rvalue_reference<A&&>::value, wampcc::json_value&&,
+    const wampcc::json_value&>::type element;
+
+  if (i >= ja.size()) {
+    /* trailing optional arguments may be absent */
+    if (is_maybe<T>::value)
+      return unpack_at(std::forward<A>(ja), i + 1, rest...);
+    return {extract_status::code::too_few, i};
+  }
+
+  if (!extract_one(static_cast<element>(ja[i]), out))
+    return {extract_status::code::wrong_type, i};
+
+  return unpack_at(std::forward<A>(ja), i + 1, rest...);
+}
+
+} // namespace detail
+
+
+/* Unpack the leading elements of a wamp argument list, in one pass, into the
+ * given variables by position.  Supported targets are int, int64_t,
+ * uint64_t, double, bool, string_view, std::string, and pointers to
+ * json_value, json_array and json_object; any of these can be wrapped in
+ * maybe<> to mark a trailing argument as optional.  Elements beyond the
+ * targets are ignored.  When unpacking from an rvalue array, std::string
+ * targets take ownership of the element strings instead of copying them;
+ * view and pointer targets are rejected there at compile time, since they
+ * would dangle once the array is destroyed.
+ *
+ *   string_view realm;
+ *   int64_t count;
+ *   maybe<bool> verbose;
+ *   if (auto st = unpack(args, realm, count, verbose)) ...
+ */
+template <typename... Ts>
+extract_status unpack(const wampcc::json_array& ja, Ts&... out)
+{
+  return detail::unpack_at(ja, 0, out...);
+}
+
+template <typename... Ts>
+extract_status unpack(wampcc::json_array&& ja, Ts&... out)
+{
+  static_assert(detail::all_owning<Ts...>::value,
+                "unpacking an rvalue array needs owning targets: numbers, "
+                "bool, std::string, or maybe<> of those");
+  return detail::unpack_at(std::move(ja), 0, out...);
+}
+
+}
+
+#endif
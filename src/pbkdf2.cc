@@ -0,0 +1,455 @@
+#include "pbkdf2.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string.h>
+#include <system_error>
+#include <thread>
+
+namespace xxx
+{
+
+namespace
+{
+
+const size_t lanes = 8;
+const size_t block_bytes = 64;
+const size_t digest_words = 8;
+const size_t digest_bytes = digest_words * 4;
+const size_t tasks_per_claim = 16;
+
+const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t sha256_iv[digest_words] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                          0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                          0x1f83d9ab, 0x5be0cd19};
+
+inline uint32_t rotr(uint32_t v, int n)
+{
+  return (v >> n) | (v << (32 - n));
+}
+
+inline uint32_t load_be32(const unsigned char* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void store_be32(unsigned char* p, uint32_t v)
+{
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+
+/* Single-buffer SHA-256, used for the per-derivation setup: hashing long
+ * passwords, the HMAC pads, and the first PBKDF2 iteration. */
+void compress(uint32_t (&h)[digest_words], const unsigned char* block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+    w[i] = load_be32(block + 4 * i);
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+  uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                  ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    uint32_t t2 =
+      (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    k = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+  h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+
+struct sha256_ctx
+{
+  uint32_t h[digest_words];
+  unsigned char buf[block_bytes];
+  size_t used;
+  uint64_t total;
+
+  /* Start from a midstate, after 'prefix' bytes already hashed */
+  sha256_ctx(const uint32_t (&state)[digest_words], uint64_t prefix = 0)
+    : used(0), total(prefix)
+  {
+    std::copy(state, state + digest_words, h);
+  }
+
+  void update(const void* data, size_t len)
+  {
+    const unsigned char* p = (const unsigned char*)data;
+    total += len;
+    while (len) {
+      size_t n = std::min(len, block_bytes - used);
+      memcpy(buf + used, p, n);
+      used += n;
+      p += n;
+      len -= n;
+      if (used == block_bytes) {
+        compress(h, buf);
+        used = 0;
+      }
+    }
+  }
+
+  void final(uint32_t (&out)[digest_words])
+  {
+    uint64_t bits = total * 8;
+    buf[used++] = 0x80;
+    if (used > block_bytes - 8) {
+      memset(buf + used, 0, block_bytes - used);
+      compress(h, buf);
+      used = 0;
+    }
+    memset(buf + used, 0, block_bytes - 8 - used);
+    store_be32(buf + 56, (uint32_t)(bits >> 32));
+    store_be32(buf + 60, (uint32_t)bits);
+    compress(h, buf);
+    std::copy(h, h + digest_words, out);
+  }
+};
+
+
+/* HMAC-SHA256 midstates: the hash state after the inner and the outer
+ * padded key block */
+struct hmac_key
+{
+  uint32_t inner[digest_words];
+  uint32_t outer[digest_words];
+
+  explicit hmac_key(string_view password)
+  {
+    unsigned char key[block_bytes] = {0};
+
+    if (password.size() > block_bytes) {
+      sha256_ctx ctx(sha256_iv);
+      ctx.update(password.data(), password.size());
+      uint32_t digest[digest_words];
+      ctx.final(digest);
+      for (size_t i = 0; i < digest_words; i++)
+        store_be32(key + 4 * i, digest[i]);
+    }
+    else if (!password.empty())
+      memcpy(key, password.data(), password.size());
+
+    unsigned char pad[block_bytes];
+    std::copy(sha256_iv, sha256_iv + digest_words, inner);
+    std::copy(sha256_iv, sha256_iv + digest_words, outer);
+    for (size_t i = 0; i < block_bytes; i++)
+      pad[i] = key[i] ^ 0x36;
+    compress(inner, pad);
+    for (size_t i = 0; i < block_bytes; i++)
+      pad[i] = key[i] ^ 0x5c;
+    compress(outer, pad);
+  }
+};
+
+
+/* SHA-256 compression across all lanes; written lane-wise, as in the
+ * ChaCha20 generator, so the compiler maps each statement onto vector
+ * instructions. */
+void compress_lanes(uint32_t (&h)[digest_words][lanes],
+                    const uint32_t (&block)[16][lanes])
+{
+  uint32_t w[64][lanes];
+  for (int i = 0; i < 16; i++)
+    for (size_t l = 0; l < lanes; l++)
+      w[i][l] = block[i][l];
+  for (int i = 16; i < 64; i++)
+    for (size_t l = 0; l < lanes; l++) {
+      uint32_t x = w[i - 15][l], y = w[i - 2][l];
+      uint32_t s0 = rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3);
+      uint32_t s1 = rotr(y, 17) ^ rotr(y, 19) ^ (y >> 10);
+      w[i][l] = w[i - 16][l] + s0 + w[i - 7][l] + s1;
+    }
+
+  uint32_t a[lanes], b[lanes], c[lanes], d[lanes];
+  uint32_t e[lanes], f[lanes], g[lanes], k[lanes];
+  for (size_t l = 0; l < lanes; l++) {
+    a[l] = h[0][l]; b[l] = h[1][l]; c[l] = h[2][l]; d[l] = h[3][l];
+    e[l] = h[4][l]; f[l] = h[5][l]; g[l] = h[6][l]; k[l] = h[7][l];
+  }
+
+  for (int i = 0; i < 64; i++)
+    for (size_t l = 0; l < lanes; l++) {
+      uint32_t t1 = k[l] + (rotr(e[l], 6) ^ rotr(e[l], 11) ^ rotr(e[l], 25)) +
+                    ((e[l] & f[l]) ^ (~e[l] & g[l])) + sha256_k[i] + w[i][l];
+      uint32_t t2 = (rotr(a[l], 2) ^ rotr(a[l], 13) ^ rotr(a[l], 22)) +
+                    ((a[l] & b[l]) ^ (a[l] & c[l]) ^ (b[l] & c[l]));
+      k[l] = g[l]; g[l] = f[l]; f[l] = e[l]; e[l] = d[l] + t1;
+      d[l] = c[l]; c[l] = b[l]; b[l] = a[l]; a[l] = t1 + t2;
+    }
+
+  for (size_t l = 0; l < lanes; l++) {
+    h[0][l] += a[l]; h[1][l] += b[l]; h[2][l] += c[l]; h[3][l] += d[l];
+    h[4][l] += e[l]; h[5][l] += f[l]; h[6][l] += g[l]; h[7][l] += k[l];
+  }
+}
+
+
+/* Work shared by all threads of one compute_salted_passwords call.  A task
+ * is one 32 byte block of one derived key. */
+struct job
+{
+  const std::vector<pbkdf2_input>& inputs;
+  std::vector<std::string>& outputs;
+  int iterations;
+  size_t keylen;
+  size_t blocks;  /* per derived key */
+  size_t tasks;
+  std::atomic<size_t> next_task;
+
+  job(const std::vector<pbkdf2_input>& in, std::vector<std::string>& out,
+      int iter, size_t kl)
+    : inputs(in),
+      outputs(out),
+      iterations(iter),
+      keylen(kl),
+      blocks((kl + digest_bytes - 1) / digest_bytes),
+      tasks(in.size() * blocks),
+      next_task(0)
+  {
+  }
+};
+
+
+/* One thread's set of interleaved derivations.  Each lane carries the HMAC
+ * midstates of its password, the last PBKDF2 iterate U and the running XOR
+ * of them.  Lanes are refilled as they finish, so each multi-buffer step
+ * advances every busy lane by one iteration. */
+class lane_worker
+{
+public:
+  explicit lane_worker(job& j) : m_job(j), m_claimed(0), m_claim_end(0),
+                                 m_key_input((size_t)-1), m_key(string_view())
+  {
+  }
+
+  void run()
+  {
+    size_t busy = 0;
+    for (size_t l = 0; l < lanes; l++)
+      if ((m_active[l] = refill(l)))
+        busy++;
+
+    while (busy) {
+      step();
+      for (size_t l = 0; l < lanes; l++)
+        if (m_active[l] && --m_remaining[l] == 0) {
+          finish(l);
+          if (!(m_active[l] = refill(l)))
+            busy--;
+        }
+    }
+  }
+
+private:
+  bool next_task(size_t& task)
+  {
+    if (m_claimed == m_claim_end) {
+      m_claimed = m_job.next_task.fetch_add(tasks_per_claim);
+      m_claim_end = std::min(m_claimed + tasks_per_claim, m_job.tasks);
+      if (m_claimed >= m_claim_end) {
+        m_claimed = m_claim_end;
+        return false;
+      }
+    }
+    task = m_claimed++;
+    return true;
+  }
+
+  /* Start lane 'l' on the next task, doing its first iteration here.
+   * Returns false when there is no work left. */
+  bool refill(size_t l)
+  {
+    size_t task;
+    while (next_task(task)) {
+      size_t input = task / m_job.blocks;
+      uint32_t block = (uint32_t)(task % m_job.blocks);
+
+      if (input != m_key_input) {
+        m_key = hmac_key(m_job.inputs[input].password);
+        m_key_input = input;
+      }
+
+      unsigned char index[4];
+      store_be32(index, block + 1);
+
+      uint32_t digest[digest_words];
+      sha256_ctx inner(m_key.inner, block_bytes);
+      inner.update(m_job.inputs[input].salt.data(),
+                   m_job.inputs[input].salt.size());
+      inner.update(index, sizeof index);
+      inner.final(digest);
+
+      unsigned char bytes[digest_bytes];
+      for (size_t i = 0; i < digest_words; i++)
+        store_be32(bytes + 4 * i, digest[i]);
+      sha256_ctx outer(m_key.outer, block_bytes);
+      outer.update(bytes, sizeof bytes);
+      outer.final(digest);
+
+      for (size_t i = 0; i < digest_words; i++) {
+        m_inner[i][l] = m_key.inner[i];
+        m_outer[i][l] = m_key.outer[i];
+        m_u[i][l] = digest[i];
+        m_acc[i][l] = digest[i];
+      }
+      m_input[l] = input;
+      m_block[l] = block;
+      m_remaining[l] = m_job.iterations - 1;
+
+      if (m_remaining[l] > 0)
+        return true;
+      finish(l);
+    }
+    return false;
+  }
+
+  /* One PBKDF2 iteration, U = HMAC(password, U), on every lane.  Both hash
+   * inputs are a single block: 32 bytes of message after the 64 byte pad. */
+  void step()
+  {
+    uint32_t block[16][lanes];
+    uint32_t state[digest_words][lanes];
+
+    for (size_t l = 0; l < lanes; l++) {
+      block[8][l] = 0x80000000;
+      for (int i = 9; i < 15; i++)
+        block[i][l] = 0;
+      block[15][l] = (block_bytes + digest_bytes) * 8;
+    }
+
+    for (size_t i = 0; i < digest_words; i++)
+      for (size_t l = 0; l < lanes; l++) {
+        block[i][l] = m_u[i][l];
+        state[i][l] = m_inner[i][l];
+      }
+    compress_lanes(state, block);
+
+    for (size_t i = 0; i < digest_words; i++)
+      for (size_t l = 0; l < lanes; l++) {
+        block[i][l] = state[i][l];
+        state[i][l] = m_outer[i][l];
+      }
+    compress_lanes(state, block);
+
+    for (size_t i = 0; i < digest_words; i++)
+      for (size_t l = 0; l < lanes; l++) {
+        m_u[i][l] = state[i][l];
+        m_acc[i][l] ^= state[i][l];
+      }
+  }
+
+  /* Write lane 'l's block of the derived key, as hex */
+  void finish(size_t l)
+  {
+    static const char* hexalphabet = "0123456789abcdef";
+
+    unsigned char bytes[digest_bytes];
+    for (size_t i = 0; i < digest_words; i++)
+      store_be32(bytes + 4 * i, m_acc[i][l]);
+
+    size_t begin = m_block[l] * digest_bytes;
+    size_t len = std::min(digest_bytes, m_job.keylen - begin);
+    char* dest = &m_job.outputs[m_input[l]][2 * begin];
+    for (size_t i = 0; i < len; i++) {
+      dest[2 * i] = hexalphabet[bytes[i] >> 4];
+      dest[2 * i + 1] = hexalphabet[bytes[i] & 0xF];
+    }
+  }
+
+  job& m_job;
+  size_t m_claimed;   /* next task of the current claim */
+  size_t m_claim_end;
+
+  size_t m_key_input; /* input whose key m_key holds */
+  hmac_key m_key;
+
+  uint32_t m_inner[digest_words][lanes];
+  uint32_t m_outer[digest_words][lanes];
+  uint32_t m_u[digest_words][lanes];
+  uint32_t m_acc[digest_words][lanes];
+  size_t m_input[lanes];
+  uint32_t m_block[lanes];
+  int m_remaining[lanes];
+  bool m_active[lanes];
+};
+
+} // namespace
+
+
+std::vector<std::string> compute_salted_passwords(
+  const std::vector<pbkdf2_input>& inputs,
+  int iterations,
+  int keylen,
+  unsigned threads,
+  pbkdf2_stats* stats)
+{
+  if (iterations < 1)
+    throw std::runtime_error("PBKDF2 iterations must be at least one");
+  if (keylen < 1)
+    throw std::runtime_error("PBKDF2 key length must be at least one");
+
+  clock_source clock(clock_type::monotonic);
+  epoch_nanos start = clock.now();
+
+  std::vector<std::string> outputs(inputs.size(),
+                                   std::string(2 * (size_t)keylen, '0'));
+  job work(inputs, outputs, iterations, keylen);
+
+  /* no more threads than can keep their lanes busy */
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = (unsigned)std::max<size_t>(
+    1, std::min<size_t>(threads, (work.tasks + lanes - 1) / lanes));
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++) {
+    /* if a thread cannot be started, the others take its share */
+    try {
+      pool.emplace_back([&work]() { lane_worker(work).run(); });
+    }
+    catch (const std::system_error&) {
+      break;
+    }
+  }
+  lane_worker(work).run();
+  for (auto& t : pool)
+    t.join();
+
+  if (stats) {
+    stats->derivations = inputs.size();
+    stats->threads = (unsigned)pool.size() + 1;
+    stats->lanes = lanes;
+    stats->seconds = (clock.now() - start) / 1e9;
+  }
+
+  return outputs;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef XXX_PBKDF2_H
+#define XXX_PBKDF2_H
+
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace xxx
+{
+
+struct pbkdf2_input
+{
+  string_view password;
+  string_view salt;
+};
+
+/* Throughput of a compute_salted_passwords call */
+struct pbkdf2_stats
+{
+  size_t derivations = 0;
+  unsigned threads = 0;
+  size_t lanes = 0;          /* interleaved derivations per thread */
+  double seconds = 0;
+
+  double per_second() const { return seconds > 0 ? derivations / seconds : 0; }
+};
+
+/* Bulk PBKDF2-HMAC-SHA256, for re-deriving many credentials at once.
+ *
+ * Returns, for each input, the same hex string compute_salted_password
+ * gives.  Each thread interleaves several derivations, one per lane of a
+ * multi-buffer SHA-256, and the inputs are shared out across 'threads'
+ * threads, or one per core if zero.  If 'stats' is given it is filled in
+ * with the elapsed time.  Throws std::runtime_error if iterations or keylen
+ * is less than one. */
+std::vector<std::string> compute_salted_passwords(
+  const std::vector<pbkdf2_input>& inputs,
+  int iterations,
+  int keylen,
+  unsigned threads = 0,
+  pbkdf2_stats* stats = nullptr);
+
+}
+
+#endif
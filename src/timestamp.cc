@@ -0,0 +1,380 @@
+#include "timestamp.h"
+
+#include <cstdint>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace xxx
+{
+
+static constexpr int64_t nanos_per_sec = 1000000000LL;
+static constexpr int64_t secs_per_day = 86400;
+
+/* Read 'n' decimal digits at 'p' */
+static inline bool read_digits(const char* p, int n, int& out)
+{
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    unsigned d = (unsigned char)p[i] - '0';
+    if (d > 9)
+      return false;
+    v = v * 10 + d;
+  }
+  out = v;
+  return true;
+}
+
+/* As read_digits, when the characters are known to be digits */
+static inline int digits2(const char* p)
+{
+  return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+static inline int digits3(const char* p)
+{
+  return digits2(p) * 10 + (p[2] - '0');
+}
+
+static inline int digits4(const char* p)
+{
+  return digits2(p) * 100 + digits2(p + 2);
+}
+
+
+static bool is_leap(int y)
+{
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+
+static bool valid_date(int y, int m, int d)
+{
+  static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+  if (m < 1 || m > 12 || d < 1)
+    return false;
+  return d <= days[m - 1] + (m == 2 && is_leap(y));
+}
+
+
+/* Days since 1970-01-01 of a proleptic Gregorian date; H. Hinnant's
+ * days_from_civil algorithm. */
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+
+static int64_t civil_seconds(int y, int mon, int d, int h, int min, int s)
+{
+  return days_from_civil(y, mon, d) * secs_per_day + h * 3600 + min * 60 + s;
+}
+
+
+/* Combine seconds and a fraction, 0 to nanos_per_sec - 1, into epoch_nanos.
+ * Returns false if the instant is outside the range of epoch_nanos, roughly
+ * 1677-09-21 to 2262-04-11. */
+static bool to_epoch_nanos(int64_t secs, int64_t frac, epoch_nanos& out)
+{
+  static const int64_t max_secs = INT64_MAX / nanos_per_sec;
+  static const int64_t min_secs = INT64_MIN / nanos_per_sec - 1;
+
+  if (secs > max_secs || secs < min_secs)
+    return false;
+  if (secs == max_secs && frac > INT64_MAX % nanos_per_sec)
+    return false;
+  if (secs == min_secs && frac < nanos_per_sec + INT64_MIN % nanos_per_sec)
+    return false;
+
+  /* for negative seconds, step back from the next second up, so that the
+   * earliest second does not overflow before the fraction is added */
+  if (secs < 0)
+    out = (secs + 1) * nanos_per_sec + (frac - nanos_per_sec);
+  else
+    out = secs * nanos_per_sec + frac;
+  return true;
+}
+
+
+/* Parse up to nine fraction digits as nanoseconds; further digits are
+ * consumed but ignored.  At least one digit is required. */
+static bool read_fraction(const char* p, size_t n, size_t& i, int64_t& nanos)
+{
+  static const int64_t scale[] = {1000000000, 100000000, 10000000, 1000000,
+                                  100000,     10000,     1000,     100,
+                                  10,         1};
+  size_t start = i;
+  int64_t v = 0;
+  int count = 0;
+
+  while (i < n && (unsigned)((unsigned char)p[i] - '0') <= 9) {
+    if (count < 9) {
+      v = v * 10 + (p[i] - '0');
+      count++;
+    }
+    i++;
+  }
+
+  if (i == start)
+    return false;
+
+  nanos = v * scale[count];
+  return true;
+}
+
+
+bool parse_iso8601(string_view s, epoch_nanos& out) noexcept
+{
+  const char* p = s.data();
+  const size_t n = s.size();
+  int year, mon, day, hour = 0, min = 0, sec = 0;
+  int64_t frac = 0, offset = 0;
+
+  if (n < 10 || !read_digits(p, 4, year) || p[4] != '-' ||
+      !read_digits(p + 5, 2, mon) || p[7] != '-' ||
+      !read_digits(p + 8, 2, day) || !valid_date(year, mon, day))
+    return false;
+
+  size_t i = 10;
+
+  if (i < n) {
+    if (p[i] != 'T' && p[i] != 't' && p[i] != ' ')
+      return false;
+
+    if (n < i + 6 || !read_digits(p + i + 1, 2, hour) || p[i + 3] != ':' ||
+        !read_digits(p + i + 4, 2, min) || hour > 23 || min > 59)
+      return false;
+    i += 6;
+
+    if (i < n && p[i] == ':') {
+      if (n < i + 3 || !read_digits(p + i + 1, 2, sec) || sec > 60)
+        return false;
+      i += 3;
+
+      if (i < n && (p[i] == '.' || p[i] == ',')) {
+        i++;
+        if (!read_fraction(p, n, i, frac))
+          return false;
+      }
+    }
+
+    if (i < n && (p[i] == 'Z' || p[i] == 'z'))
+      i++;
+    else if (i < n && (p[i] == '+' || p[i] == '-')) {
+      int sign = (p[i] == '-') ? -1 : 1;
+      int oh, om = 0;
+      if (n < i + 3 || !read_digits(p + i + 1, 2, oh))
+        return false;
+      i += 3;
+      if (i < n && p[i] == ':') {
+        if (n < i + 3 || !read_digits(p + i + 1, 2, om))
+          return false;
+        i += 3;
+      }
+      else if (n == i + 2) {
+        if (!read_digits(p + i, 2, om))
+          return false;
+        i += 2;
+      }
+      if (oh > 23 || om > 59)
+        return false;
+      offset = sign * (oh * 3600 + om * 60);
+    }
+
+    if (i != n)
+      return false;
+  }
+
+  return to_epoch_nanos(civil_seconds(year, mon, day, hour, min, sec) - offset,
+                        frac, out);
+}
+
+
+/* UTC offset, in seconds, of the local time zone at time 't' */
+static int64_t local_offset(int64_t t)
+{
+  struct tm parts;
+  time_t tt = (time_t)t;
+  localtime_r(&tt, &parts);
+  return civil_seconds(parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
+                       parts.tm_hour, parts.tm_min, parts.tm_sec) - t;
+}
+
+
+/* local_offset, cached per 15 minute interval in which the offset is
+ * constant; zone transitions do not occur more often than that. */
+static int64_t cached_local_offset(int64_t t)
+{
+  static const int64_t bucket_secs = 900;
+
+  struct bucket
+  {
+    int64_t index;
+    int64_t offset;
+    bool valid;
+  };
+  thread_local bucket cache[4];
+
+  int64_t index = (t >= 0 ? t : t - bucket_secs + 1) / bucket_secs;
+  bucket& b = cache[index & 3];
+
+  if (b.valid && b.index == index)
+    return b.offset;
+
+  int64_t first = local_offset(index * bucket_secs);
+  int64_t last = local_offset(index * bucket_secs + bucket_secs - 1);
+
+  if (first != last)
+    return local_offset(t);
+
+  b.index = index;
+  b.offset = first;
+  b.valid = true;
+  return first;
+}
+
+
+/* Convert local civil seconds to UTC seconds.  Candidate offsets are taken
+ * from either side of the time; the earliest candidate consistent with its
+ * own offset wins. */
+static int64_t local_to_utc(int64_t local)
+{
+  static const int64_t window = 6 * 3600;
+
+  int64_t guess = local - cached_local_offset(local);
+  const int64_t offsets[] = {cached_local_offset(guess - window),
+                             cached_local_offset(guess),
+                             cached_local_offset(guess + window)};
+
+  bool found = false;
+  int64_t best = guess;
+  for (int64_t offset : offsets) {
+    int64_t t = local - offset;
+    if (cached_local_offset(t) == offset && (!found || t < best)) {
+      best = t;
+      found = true;
+    }
+  }
+
+  return best; /* when in a gap, clocks going forward, use the guess */
+}
+
+
+bool parse_local_timestamp(string_view s, epoch_nanos& out) noexcept
+{
+  const char* p = s.data();
+  const size_t n = s.size();
+  int year, mon, day, hour, min, sec;
+  int64_t frac = 0;
+
+  if (n < 17 || !read_digits(p, 4, year) || !read_digits(p + 4, 2, mon) ||
+      !read_digits(p + 6, 2, day) || p[8] != '-' ||
+      !read_digits(p + 9, 2, hour) || p[11] != ':' ||
+      !read_digits(p + 12, 2, min) || p[14] != ':' ||
+      !read_digits(p + 15, 2, sec))
+    return false;
+
+  if (!valid_date(year, mon, day) || hour > 23 || min > 59 || sec > 60)
+    return false;
+
+  size_t i = 17;
+  if (i < n) {
+    if (p[i] != '.' || n - i - 1 > 9)
+      return false;
+    i++;
+    if (!read_fraction(p, n, i, frac) || i != n)
+      return false;
+  }
+
+  int64_t local = civil_seconds(year, mon, day, hour, min, sec);
+  return to_epoch_nanos(local_to_utc(local), frac, out);
+}
+
+
+/* Is 's' exactly of the form YYYY-MM-DDThh:mm:ss.sssZ */
+static bool is_canonical_iso8601(string_view s)
+{
+  static const size_t len = 24;
+  if (s.size() != len)
+    return false;
+
+#if defined(__SSE2__)
+  /* Two overlapping 16 byte loads cover the 24 characters.  Per load, the
+   * bits of the digit positions and of the separator positions. */
+  static const int digits_lo = 0xDB6F;  /* 0-3,5,6,8,9,11,12,14,15 */
+  static const int seps_lo = 0x2490;    /* 4,7,10,13 */
+  static const int digits_hi = 0x76DB;  /* 8,9,11,12,14,15,17,18,20-22 */
+  static const int seps_hi = 0x8924;    /* 10,13,16,19,23 */
+
+  const __m128i lo = _mm_loadu_si128((const __m128i*)s.data());
+  const __m128i hi = _mm_loadu_si128((const __m128i*)(s.data() + 8));
+  const __m128i tmpl_lo = _mm_setr_epi8(0, 0, 0, 0, '-', 0, 0, '-', 0, 0, 'T',
+                                        0, 0, ':', 0, 0);
+  const __m128i tmpl_hi = _mm_setr_epi8(0, 0, 'T', 0, 0, ':', 0, 0, ':', 0,
+                                        0, '.', 0, 0, 0, 'Z');
+  const __m128i zero = _mm_set1_epi8('0' - 1);
+  const __m128i nine = _mm_set1_epi8('9' + 1);
+
+  int dlo = _mm_movemask_epi8(
+    _mm_and_si128(_mm_cmpgt_epi8(lo, zero), _mm_cmplt_epi8(lo, nine)));
+  int dhi = _mm_movemask_epi8(
+    _mm_and_si128(_mm_cmpgt_epi8(hi, zero), _mm_cmplt_epi8(hi, nine)));
+  int slo = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, tmpl_lo));
+  int shi = _mm_movemask_epi8(_mm_cmpeq_epi8(hi, tmpl_hi));
+
+  return (dlo & digits_lo) == digits_lo && (slo & seps_lo) == seps_lo &&
+         (dhi & digits_hi) == digits_hi && (shi & seps_hi) == seps_hi;
+#else
+  static constexpr char layout[] = "dddd-dd-ddTdd:dd:dd.dddZ";
+  for (size_t i = 0; i < len; i++) {
+    if (layout[i] == 'd') {
+      if ((unsigned)((unsigned char)s[i] - '0') > 9)
+        return false;
+    }
+    else if (s[i] != layout[i])
+      return false;
+  }
+  return true;
+#endif
+}
+
+
+/* Parse a timestamp known to be in canonical form, from fixed offsets */
+static bool parse_canonical_iso8601(const char* p, epoch_nanos& out)
+{
+  int year = digits4(p), mon = digits2(p + 5), day = digits2(p + 8);
+  int hour = digits2(p + 11), min = digits2(p + 14), sec = digits2(p + 17);
+
+  if (!valid_date(year, mon, day) || hour > 23 || min > 59 || sec > 60)
+    return false;
+
+  return to_epoch_nanos(civil_seconds(year, mon, day, hour, min, sec),
+                        digits3(p + 20) * (int64_t)1000000, out);
+}
+
+
+size_t parse_iso8601_batch(const string_view* in, size_t count,
+                           epoch_nanos* out, bool* ok) noexcept
+{
+  size_t parsed = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (is_canonical_iso8601(in[i]))
+      ok[i] = parse_canonical_iso8601(in[i].data(), out[i]);
+    else
+      ok[i] = parse_iso8601(in[i], out[i]);
+    parsed += ok[i];
+  }
+
+  return parsed;
+}
+
+}
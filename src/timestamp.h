@@ -0,0 +1,41 @@
+#ifndef XXX_TIMESTAMP_H
+#define XXX_TIMESTAMP_H
+
+#include "utils.h"
+
+namespace xxx
+{
+
+/* Parsers for the timestamp formats written by iso8601_utc_timestamp and
+ * local_timestamp.  Digits are read from fixed offsets, and no locale
+ * dependent libc routine is called.  Formatting a parsed value reproduces
+ * the original string exactly.
+ *
+ * On success true is returned and 'out' set to nanoseconds since the epoch;
+ * on malformed input, or for an instant outside the range of epoch_nanos,
+ * 1677-09-21T00:12:43.145224192Z to 2262-04-11T23:47:16.854775807Z, false
+ * is returned and 'out' is unchanged. */
+
+/* Parse an ISO-8601 timestamp, like YYYY-MM-DDThh:mm:ss.sssZ.  Also accepted
+ * are: 't' or a space for 'T'; omitted seconds; any number of fraction
+ * digits (beyond nine are ignored) with '.' or ','; 'z', or an offset of the
+ * form +hh, +hh:mm or +hhmm, or none, which is taken as UTC; and a bare date,
+ * YYYY-MM-DD, which is taken as midnight UTC. */
+bool parse_iso8601(string_view, epoch_nanos& out) noexcept;
+
+/* Parse a local time timestamp, like YYYYMMDD-hh:mm:ss.uuuuuu, converting
+ * from the local time zone.  The fraction is optional and may have up to
+ * nine digits.  Within a repeated hour, when clocks go back, the earlier
+ * instant is returned. */
+bool parse_local_timestamp(string_view, epoch_nanos& out) noexcept;
+
+/* Parse a column of ISO-8601 timestamps, writing each result and whether it
+ * succeeded.  Entries in the exact form written by iso8601_utc_timestamp
+ * are validated with SIMD compares where available; others fall back to
+ * parse_iso8601.  Returns the number parsed successfully. */
+size_t parse_iso8601_batch(const string_view* in, size_t count,
+                           epoch_nanos* out, bool* ok) noexcept;
+
+}
+
+#endif
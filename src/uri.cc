@@ -0,0 +1,233 @@
+#include "uri.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* URIs are validated a block of bytes at a time.  Each block is classified
+ * into two bitmasks, one bit per byte: bytes not permitted anywhere in the
+ * URI, and '.' delimiters.  Empty components are then detected from the
+ * delimiter mask alone: a leading or trailing '.', or two adjacent.  The
+ * block width is 32 bytes with AVX2, 16 with SSE2, and 16 via a scalar loop
+ * otherwise; the choice is made at compile time. */
+
+namespace xxx
+{
+
+namespace
+{
+
+struct block_masks
+{
+  uint32_t invalid;
+  uint32_t dots;
+};
+
+inline bool is_strict_char(unsigned char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || (c == '_');
+}
+
+inline bool is_loose_char(unsigned char c)
+{
+  return c != '\0' && c != ' ' && !(c >= '\t' && c <= '\r') && c != '#';
+}
+
+
+#if defined(__AVX2__)
+
+struct strict_classifier
+{
+  static const size_t width = 32;
+
+  static block_masks classify(const char* p) noexcept
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(
+      _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i digit = _mm256_and_si256(
+      _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    __m256i dot = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'));
+    __m256i ok = _mm256_or_si256(_mm256_or_si256(alpha, digit),
+                                 _mm256_or_si256(under, dot));
+    return {~(uint32_t)_mm256_movemask_epi8(ok),
+            (uint32_t)_mm256_movemask_epi8(dot)};
+  }
+};
+
+struct loose_classifier
+{
+  static const size_t width = 32;
+
+  static block_masks classify(const char* p) noexcept
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i ctrl = _mm256_and_si256(
+      _mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    __m256i bad = _mm256_or_si256(
+      _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('#')),
+                      _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+    __m256i dot = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'));
+    return {(uint32_t)_mm256_movemask_epi8(bad),
+            (uint32_t)_mm256_movemask_epi8(dot)};
+  }
+};
+
+#elif defined(__SSE2__)
+
+struct strict_classifier
+{
+  static const size_t width = 16;
+
+  static block_masks classify(const char* p) noexcept
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    __m128i dot = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+    __m128i ok = _mm_or_si128(_mm_or_si128(alpha, digit),
+                              _mm_or_si128(under, dot));
+    return {(uint32_t)_mm_movemask_epi8(ok) ^ 0xFFFFu,
+            (uint32_t)_mm_movemask_epi8(dot)};
+  }
+};
+
+struct loose_classifier
+{
+  static const size_t width = 16;
+
+  static block_masks classify(const char* p) noexcept
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    __m128i bad = _mm_or_si128(
+      _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')),
+                   _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+    __m128i dot = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+    return {(uint32_t)_mm_movemask_epi8(bad),
+            (uint32_t)_mm_movemask_epi8(dot)};
+  }
+};
+
+#else
+
+template <bool (*Valid)(unsigned char)>
+struct scalar_classifier
+{
+  static const size_t width = 16;
+
+  static block_masks classify(const char* p) noexcept
+  {
+    block_masks m = {0, 0};
+    for (size_t i = 0; i < width; i++) {
+      unsigned char c = p[i];
+      if (c == '.')
+        m.dots |= 1u << i;
+      else if (!Valid(c))
+        m.invalid |= 1u << i;
+    }
+    return m;
+  }
+};
+
+typedef scalar_classifier<is_strict_char> strict_classifier;
+typedef scalar_classifier<is_loose_char> loose_classifier;
+
+#endif
+
+
+template <typename Classifier>
+bool validate(const char* p, size_t len, bool allow_empty) noexcept
+{
+  static const size_t width = Classifier::width;
+
+  if (!allow_empty && (len == 0 || p[0] == '.' || p[len - 1] == '.'))
+    return false;
+
+  uint32_t carry = 0; /* was the final byte of the previous block a '.' */
+  size_t i = 0;
+
+  while (i < len) {
+    block_masks m;
+
+    if (len - i >= width)
+      m = Classifier::classify(p + i);
+    else {
+      /* pad the tail with a byte valid under every rule */
+      char tail[width];
+      memset(tail, 'a', width);
+      memcpy(tail, p + i, len - i);
+      m = Classifier::classify(tail);
+    }
+
+    if (m.invalid)
+      return false;
+
+    if (!allow_empty) {
+      if (m.dots & ((m.dots << 1) | carry))
+        return false;
+      carry = (m.dots >> (width - 1)) & 1;
+    }
+
+    i += width;
+  }
+
+  return true;
+}
+
+
+inline bool validate(const char* p, size_t len, uri_rules rules) noexcept
+{
+  switch (rules) {
+    case uri_rules::strict:
+      return validate<strict_classifier>(p, len, false);
+    case uri_rules::loose:
+      return validate<loose_classifier>(p, len, false);
+    case uri_rules::strict_wildcard:
+      return validate<strict_classifier>(p, len, true);
+    case uri_rules::loose_wildcard:
+      return validate<loose_classifier>(p, len, true);
+  };
+  return false;
+}
+
+} // namespace
+
+
+bool is_valid_uri(string_view uri, uri_rules rules) noexcept
+{
+  return validate(uri.data(), uri.size(), rules);
+}
+
+
+size_t validate_uris(const string_view* uris, size_t count, uri_rules rules,
+                     bool* results) noexcept
+{
+  size_t valid = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    results[i] = validate(uris[i].data(), uris[i].size(), rules);
+    valid += results[i];
+  }
+
+  return valid;
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef XXX_URI_H
+#define XXX_URI_H
+
+#include "utils.h"
+
+namespace xxx
+{
+
+/* URI validation rules, per the WAMP spec.
+ *
+ * strict           components of letters, digits and '_'
+ * loose            components of any character except whitespace, '.', '#'
+ * strict_wildcard  as strict, but components may be empty
+ * loose_wildcard   as loose, but components may be empty
+ *
+ * The wildcard rules apply to the patterns of wildcard subscriptions and
+ * registrations.  Prefix patterns use the plain strict or loose rules.  Note
+ * that, unlike the spec, strict URIs here also accept upper case letters;
+ * this has always been the behaviour of is_strict_uri.  The NUL character is
+ * rejected under every rule. */
+enum class uri_rules
+{
+  strict,
+  loose,
+  strict_wildcard,
+  loose_wildcard
+};
+
+/** Return if the string is a valid URI under the given rules */
+bool is_valid_uri(string_view, uri_rules) noexcept;
+
+/** Validate 'count' URIs under the same rules, writing each verdict into
+ * 'results'.  Returns the number of URIs found valid. */
+size_t validate_uris(const string_view* uris, size_t count, uri_rules,
+                     bool* results) noexcept;
+
+}
+
+#endif
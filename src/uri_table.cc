@@ -0,0 +1,393 @@
+#include "uri_table.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace xxx
+{
+
+uint64_t uri_table::hash(string_view s) noexcept
+{
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < s.size(); i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+
+uri_table::uri_table(uri_rules rules)
+  : m_rules(rules),
+    m_size(0)
+{
+  for (auto& chunk : m_chunks)
+    chunk.store(nullptr, std::memory_order_relaxed);
+}
+
+
+uri_table::~uri_table()
+{
+  for (auto& chunk : m_chunks)
+    delete [] chunk.load();
+}
+
+
+const uri_table::entry& uri_table::entry_at(uri_id id) const
+{
+  entry* chunk = nullptr;
+  if (id < m_size.load(std::memory_order_acquire))
+    chunk = m_chunks[id >> chunk_bits].load(std::memory_order_acquire);
+  if (!chunk)
+    throw std::out_of_range("uri_table id out of range");
+  return chunk[id & (chunk_size - 1)];
+}
+
+
+/* Return the storage for a new ID.  Called with a shard lock held; chunks
+ * are shared between shards, so installing a new one must be atomic. */
+uri_table::entry& uri_table::allocate(uri_id id)
+{
+  std::atomic<entry*>& slot = m_chunks[id >> chunk_bits];
+  entry* chunk = slot.load(std::memory_order_acquire);
+
+  if (!chunk) {
+    entry* fresh = new entry[chunk_size];
+    if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+      chunk = fresh;
+    else
+      delete [] fresh;
+  }
+
+  return chunk[id & (chunk_size - 1)];
+}
+
+
+uri_id uri_table::intern(string_view s)
+{
+  key k{s, hash(s)};
+  shard& sh = m_shards[k.hash % shard_count];
+
+  {
+    std::lock_guard<std::mutex> guard(sh.mutex);
+    auto iter = sh.index.find(k);
+    if (iter != sh.index.end())
+      return iter->second;
+  }
+
+  if (!is_valid_uri(s, m_rules))
+    throw std::runtime_error("invalid uri '" + std::string(s.data(), s.size()) +
+                             "'");
+
+  std::lock_guard<std::mutex> guard(sh.mutex);
+  auto iter = sh.index.find(k);
+  if (iter != sh.index.end())
+    return iter->second;
+
+  uri_id id = m_size.fetch_add(1);
+  if (id >= max_chunks * chunk_size) {
+    m_size.fetch_sub(1);
+    throw std::runtime_error("uri_table full");
+  }
+
+  entry& e = allocate(id);
+  e.uri.assign(s.data(), s.size());
+  e.hash = k.hash;
+
+  /* key must refer to the table's own copy of the string */
+  sh.index.insert({key{e.uri, e.hash}, id});
+  return id;
+}
+
+
+maybe<uri_id> uri_table::find(string_view s) const noexcept
+{
+  key k{s, hash(s)};
+  const shard& sh = m_shards[k.hash % shard_count];
+
+  std::lock_guard<std::mutex> guard(sh.mutex);
+  auto iter = sh.index.find(k);
+  if (iter != sh.index.end())
+    return iter->second;
+  return {};
+}
+
+
+struct uri_pattern_index::node
+{
+  struct edge
+  {
+    string_view component; /* storage owned by m_components */
+    uint64_t hash;
+    bool operator==(const edge& rhs) const { return component == rhs.component; }
+  };
+
+  struct edge_hash
+  {
+    size_t operator()(const edge& e) const noexcept { return e.hash; }
+  };
+
+  std::unordered_map<edge, std::unique_ptr<node>, edge_hash> children;
+  std::unique_ptr<node> any; /* empty component of a wildcard pattern */
+
+  std::vector<uint64_t> exact;
+  std::vector<uint64_t> wildcard;
+  std::vector<std::pair<std::string, uint64_t>> prefixes;
+
+  bool empty() const
+  {
+    return children.empty() && !any && exact.empty() && wildcard.empty() &&
+           prefixes.empty();
+  }
+};
+
+
+static uri_rules base_rules(uri_rules rules)
+{
+  switch (rules) {
+    case uri_rules::strict:
+    case uri_rules::strict_wildcard:
+      return uri_rules::strict;
+    case uri_rules::loose:
+    case uri_rules::loose_wildcard:
+      return uri_rules::loose;
+  };
+  return uri_rules::strict;
+}
+
+
+static uri_rules wildcard_rules(uri_rules rules)
+{
+  return base_rules(rules) == uri_rules::strict ? uri_rules::strict_wildcard
+                                                : uri_rules::loose_wildcard;
+}
+
+
+/* Split off the leading component of 'rest'.  Returns false when there are
+ * no components left. */
+static bool next_component(string_view& rest, bool& more, string_view& comp)
+{
+  if (!more)
+    return false;
+
+  size_t pos = rest.find('.');
+  if (pos == string_view::npos) {
+    comp = rest;
+    more = false;
+  }
+  else {
+    comp = rest.substr(0, pos);
+    rest = rest.substr(pos + 1);
+  }
+  return true;
+}
+
+
+static bool starts_with(string_view s, const std::string& prefix)
+{
+  return s.size() >= prefix.size() &&
+         std::equal(prefix.begin(), prefix.end(), s.begin());
+}
+
+
+uri_pattern_index::uri_pattern_index(uri_rules rules)
+  : m_rules(base_rules(rules)),
+    m_components(m_rules),
+    m_root(new node)
+{
+}
+
+
+uri_pattern_index::~uri_pattern_index() = default;
+
+
+uri_pattern_index::node* uri_pattern_index::find_node(string_view pattern,
+                                                      bool create)
+{
+  node* n = m_root.get();
+  bool more = !pattern.empty();
+  string_view comp;
+
+  while (n && next_component(pattern, more, comp)) {
+    if (comp.empty()) {
+      if (!n->any && create)
+        n->any.reset(new node);
+      n = n->any.get();
+      continue;
+    }
+
+    node::edge e{comp, uri_table::hash(comp)};
+    auto iter = n->children.find(e);
+    if (iter != n->children.end())
+      n = iter->second.get();
+    else if (create) {
+      const std::string& stored = m_components.uri(m_components.intern(comp));
+      node* child = new node;
+      n->children.insert({node::edge{stored, e.hash},
+                          std::unique_ptr<node>(child)});
+      n = child;
+    }
+    else
+      n = nullptr;
+  }
+
+  return n;
+}
+
+
+/* Split a prefix pattern into its trie path and the trailing, possibly
+ * partial, component. */
+static void split_prefix(string_view pattern, string_view& path,
+                         std::string& fragment)
+{
+  size_t pos = pattern.size();
+  while (pos > 0 && pattern[pos - 1] != '.')
+    pos--;
+
+  path = pos ? pattern.substr(0, pos - 1) : string_view();
+  string_view tail = pattern.substr(pos);
+  fragment.assign(tail.data(), tail.size());
+}
+
+
+static void throw_invalid(string_view pattern)
+{
+  throw std::runtime_error("invalid uri pattern '" +
+                           std::string(pattern.data(), pattern.size()) + "'");
+}
+
+
+void uri_pattern_index::add(string_view pattern, match_policy policy,
+                            uint64_t value)
+{
+  switch (policy) {
+    case match_policy::exact: {
+      if (!is_valid_uri(pattern, m_rules))
+        throw_invalid(pattern);
+      find_node(pattern, true)->exact.push_back(value);
+      break;
+    }
+    case match_policy::wildcard: {
+      if (!is_valid_uri(pattern, wildcard_rules(m_rules)))
+        throw_invalid(pattern);
+      find_node(pattern, true)->wildcard.push_back(value);
+      break;
+    }
+    case match_policy::prefix: {
+      /* a prefix may end with the delimiter, eg "com.myapp." */
+      string_view body = pattern;
+      if (!body.empty() && body[body.size() - 1] == '.')
+        body = body.substr(0, body.size() - 1);
+      if (!is_valid_uri(body, m_rules))
+        throw_invalid(pattern);
+
+      string_view path;
+      std::string fragment;
+      split_prefix(pattern, path, fragment);
+      find_node(path, true)->prefixes.emplace_back(std::move(fragment), value);
+      break;
+    }
+  };
+}
+
+
+bool uri_pattern_index::remove(string_view pattern, match_policy policy,
+                               uint64_t value)
+{
+  string_view path = pattern;
+  std::string fragment;
+
+  if (policy == match_policy::prefix)
+    split_prefix(pattern, path, fragment);
+
+  node* n = find_node(path, false);
+  if (!n)
+    return false;
+
+  bool found = false;
+
+  switch (policy) {
+    case match_policy::exact:
+    case match_policy::wildcard: {
+      auto& values = (policy == match_policy::exact) ? n->exact : n->wildcard;
+      auto iter = std::find(values.begin(), values.end(), value);
+      if (iter != values.end()) {
+        values.erase(iter);
+        found = true;
+      }
+      break;
+    }
+    case match_policy::prefix: {
+      auto iter = std::find(n->prefixes.begin(), n->prefixes.end(),
+                            std::make_pair(fragment, value));
+      if (iter != n->prefixes.end()) {
+        n->prefixes.erase(iter);
+        found = true;
+      }
+      break;
+    }
+  };
+
+  if (found && n->empty())
+    prune(m_root.get(), path, !path.empty());
+
+  return found;
+}
+
+
+/* Remove empty nodes along the remaining 'path', deepest first.  Returns
+ * true if 'n' is itself left empty. */
+bool uri_pattern_index::prune(node* n, string_view path, bool more)
+{
+  string_view comp;
+
+  if (next_component(path, more, comp)) {
+    if (comp.empty()) {
+      if (n->any && prune(n->any.get(), path, more))
+        n->any.reset();
+    }
+    else {
+      auto iter = n->children.find(node::edge{comp, uri_table::hash(comp)});
+      if (iter != n->children.end() && prune(iter->second.get(), path, more))
+        n->children.erase(iter);
+    }
+  }
+
+  return n->empty();
+}
+
+
+/* Walk the trie from node 'n' matching the remaining components of the URI,
+ * in 'rest'.  'more' is false once all components are consumed. */
+void uri_pattern_index::match_node(const node* n, string_view rest, bool more,
+                                   std::vector<uint64_t>& out)
+{
+  string_view comp;
+
+  if (!next_component(rest, more, comp)) {
+    out.insert(out.end(), n->exact.begin(), n->exact.end());
+    out.insert(out.end(), n->wildcard.begin(), n->wildcard.end());
+    return;
+  }
+
+  for (auto& item : n->prefixes)
+    if (starts_with(comp, item.first))
+      out.push_back(item.second);
+
+  if (!n->children.empty()) {
+    auto iter = n->children.find(node::edge{comp, uri_table::hash(comp)});
+    if (iter != n->children.end())
+      match_node(iter->second.get(), rest, more, out);
+  }
+
+  if (n->any)
+    match_node(n->any.get(), rest, more, out);
+}
+
+
+void uri_pattern_index::match(string_view uri, std::vector<uint64_t>& out) const
+{
+  match_node(m_root.get(), uri, !uri.empty(), out);
+}
+
+}
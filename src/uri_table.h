@@ -0,0 +1,144 @@
+#ifndef XXX_URI_TABLE_H
+#define XXX_URI_TABLE_H
+
+#include "uri.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xxx
+{
+
+typedef uint32_t uri_id;
+
+/* Interning table, mapping validated URIs to small, stable integer IDs.
+ *
+ * IDs are allocated densely from zero in order of first insertion and are
+ * never reused, so they can index arrays.  Each entry caches the hash of its
+ * URI.  The table is sharded by hash, with a mutex per shard, so concurrent
+ * interning of different URIs rarely contends; lookup of an entry by ID takes
+ * no lock at all. */
+class uri_table
+{
+public:
+  explicit uri_table(uri_rules rules = uri_rules::strict);
+  ~uri_table();
+
+  uri_table(const uri_table&) = delete;
+  void operator=(const uri_table&) = delete;
+
+  /* Return the ID of the URI, adding it if not already present.  Throws
+   * std::runtime_error if the URI is not valid under the table rules, or
+   * the table is full. */
+  uri_id intern(string_view);
+
+  /* Find the ID of a URI already interned */
+  maybe<uri_id> find(string_view) const noexcept;
+
+  /* Access the URI, and its cached hash, for an ID previously returned by
+   * intern or find. */
+  const std::string& uri(uri_id id) const { return entry_at(id).uri; }
+  uint64_t hash(uri_id id) const { return entry_at(id).hash; }
+
+  /* Number of URIs interned */
+  size_t size() const noexcept { return m_size.load(); }
+
+  uri_rules rules() const noexcept { return m_rules; }
+
+  /* Hash function used by the table, FNV-1a */
+  static uint64_t hash(string_view) noexcept;
+
+private:
+  static const size_t shard_count = 16;
+  static const size_t chunk_bits = 12;
+  static const size_t chunk_size = 1u << chunk_bits;
+  static const size_t max_chunks = 4096;
+
+  struct entry
+  {
+    std::string uri;
+    uint64_t hash;
+  };
+
+  struct key
+  {
+    string_view uri;
+    uint64_t hash;
+    bool operator==(const key& rhs) const { return uri == rhs.uri; }
+  };
+
+  struct key_hash
+  {
+    size_t operator()(const key& k) const noexcept { return k.hash; }
+  };
+
+  struct alignas(64) shard
+  {
+    mutable std::mutex mutex;
+    std::unordered_map<key, uri_id, key_hash> index;
+  };
+
+  const entry& entry_at(uri_id) const;
+  entry& allocate(uri_id);
+
+  uri_rules m_rules;
+  shard m_shards[shard_count];
+  std::atomic<uri_id> m_size;
+  std::atomic<entry*> m_chunks[max_chunks];
+};
+
+
+enum class match_policy { exact, prefix, wildcard };
+
+/* Index of subscription (or registration) patterns, for finding all patterns
+ * that match a given URI.
+ *
+ * Patterns are stored in a trie with one level per URI component, with the
+ * components themselves interned.  Matching walks the trie once per URI
+ * component, so costs O(depth) rather than O(patterns); wildcard patterns
+ * add a branch at each empty component.  Prefix patterns follow WAMP
+ * semantics, which are string based: "com.myapp.to" matches
+ * "com.myapp.topic".  The final partial component of a prefix is therefore
+ * tested against the URI component at that depth.
+ *
+ * Concurrent calls to match are safe; add and remove need exclusive
+ * access. */
+class uri_pattern_index
+{
+public:
+  /* 'rules' selects strict or loose URIs; wildcard patterns are checked
+   * under the corresponding wildcard rules. */
+  explicit uri_pattern_index(uri_rules rules = uri_rules::strict);
+  ~uri_pattern_index();
+
+  /* Add a pattern, associated with 'value'.  Throws std::runtime_error if the
+   * pattern is not valid for its policy. */
+  void add(string_view pattern, match_policy, uint64_t value);
+
+  /* Remove a previously added pattern and value, returning false if it was
+   * not found. */
+  bool remove(string_view pattern, match_policy, uint64_t value);
+
+  /* Append to 'out' the values of all patterns matching the URI, which is
+   * assumed to be valid. */
+  void match(string_view uri, std::vector<uint64_t>& out) const;
+
+private:
+  struct node;
+
+  node* find_node(string_view pattern, bool create);
+  bool prune(node*, string_view path, bool more);
+  static void match_node(const node*, string_view rest, bool more,
+                         std::vector<uint64_t>& out);
+
+  uri_rules m_rules;
+  uri_table m_components;
+  std::unique_ptr<node> m_root;
+};
+
+}
+
+#endif
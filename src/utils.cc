@@ -1,8 +1,14 @@
 #include "utils.h"
+#include "uri.h"
+#include "csprng.h"
+#include "instrument.h"
 
-#include <sys/time.h>
 #include <time.h>
 
+#if __cplusplus < 201703L && defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
 
@@ -13,56 +19,19 @@
 namespace xxx
 {
 
-struct time_val
-{
-#ifndef _WIN32
-  typedef long type_type;
-#else
-  typedef __time64_t type_type;
-#endif
-  type_type sec;  /* seconds */
-  type_type usec; /* micros */
-};
-
-
-time_val time_now()
+/* Split a nanosecond timestamp into whole seconds and a non-negative
+ * sub-second remainder, as needed by the libc broken-down time functions. */
+static void split_nanos(epoch_nanos t, time_t& sec, long& nanos)
 {
-#ifndef _WIN32
-  timeval epoch;
-  gettimeofday(&epoch, nullptr);
-  return {epoch.tv_sec, epoch.tv_usec};
-#else
-  SYSTEMTIME systime;
-  GetSystemTime(&systime); // obtain milliseconds
-  time_val::type_type now;
-  time(&now); // seconds elapsed since midnight January 1, 1970
-  time_val tv_systime{now, systime.wMilliseconds * 1000};
-
-  /* C++11 chrono approach */
-  /*
-  auto ts = std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::system_clock::now().time_since_epoch()).count();
-  time_val tv_chrono{ts / 1000000LL, ts % 1000000LL};
-  */
-
-  /* Windows FILETIME approach, has actual usec accuracy */
-  /*
-  FILETIME ft;
-  GetSystemTimeAsFileTime(&ft);
-  time_val::type_type tt = ft.dwHighDateTime;
-  tt <<= 32;
-  tt |= ft.dwLowDateTime;
-  tt /= 10;
-  tt -= 11644473600000000ULL;
-  time_val tv_filetime{tt / 1000000LL, tt % 1000000LL};
-  */
-
-  return tv_systime;
-#endif
+  sec = (time_t)(t / 1000000000LL);
+  nanos = (long)(t % 1000000000LL);
+  if (nanos < 0) {
+    sec -= 1;
+    nanos += 1000000000L;
+  }
 }
 
 
-
 std::string mandatory_getenv(const char * varname)
 {
   const char* var = getenv(varname);
@@ -76,23 +45,66 @@ std::string mandatory_getenv(const char * varname)
 }
 
 
+#if __cplusplus >= 201703L
+
+int uncaught_exception_count() noexcept
+{
+  return std::uncaught_exceptions();
+}
+
+#elif defined(__GNUC__)
+
+/* Before C++17, read the count from the per-thread exception globals of
+ * the Itanium C++ ABI, which is what std::uncaught_exceptions does. */
+namespace
+{
+struct cxa_eh_globals
+{
+  void* caught_exceptions;
+  unsigned int uncaught_exceptions;
+};
+}
+
+int uncaught_exception_count() noexcept
+{
+  return (int)reinterpret_cast<cxa_eh_globals*>(abi::__cxa_get_globals())
+    ->uncaught_exceptions;
+}
+
+#else
+
+int uncaught_exception_count() noexcept
+{
+  return std::uncaught_exception() ? 1 : 0;
+}
+
+#endif
+
+
 std::string local_timestamp()
+{
+  return local_timestamp(wall_clock_now());
+}
+
+
+std::string local_timestamp(epoch_nanos t)
 {
   static constexpr char format[] = "20170527-00:29:48.796000"; // 24
 
   char timestamp[32] = {0};
   struct tm parts;
-  timeval epoch;
-  gettimeofday(&epoch, nullptr);
+  time_t sec;
+  long nanos;
   int ec;
 
   static_assert(sizeof timestamp > sizeof format, "buffer too short");
 
-  localtime_r(&epoch.tv_sec, &parts);
+  split_nanos(t, sec, nanos);
+  localtime_r(&sec, &parts);
   ec = snprintf(timestamp, sizeof(timestamp),
-                "%02d%02d%02d-%02d:%02d:%02d.%06lu", parts.tm_year + 1900,
+                "%02d%02d%02d-%02d:%02d:%02d.%06ld", parts.tm_year + 1900,
                 parts.tm_mon + 1, parts.tm_mday, parts.tm_hour, parts.tm_min,
-                parts.tm_sec, epoch.tv_usec);
+                parts.tm_sec, nanos / 1000);
 
 
   if (ec < 0)
@@ -102,45 +114,9 @@ std::string local_timestamp()
   return timestamp;
 }
 
-static bool is_valid_char(char c)
-{
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-         (c >= '0' && c <= '9') || (c == '_');
-}
-
-/* Check URI conformance directly, rather than use regex.  This is to avoid
- * compilers with broken regex implementations (eg, some gcc 4.x). */
 bool is_strict_uri(const char* p) noexcept
 {
-  enum class state {
-    component,
-    component_or_delim,
-    fail
-  } st = state::component;
-
-  while (st != state::fail && *p) {
-    switch (st) {
-      case state::component: {
-        if (is_valid_char(*p))
-          st = state::component_or_delim;
-        else
-          st = state::fail;
-        break;
-      }
-      case state::component_or_delim: {
-        if (*p == '.')
-          st = state::component;
-        else if (!is_valid_char(*p))
-          st = state::fail;
-        break;
-      }
-      case state::fail:
-        break;
-    };
-    p++;
-  }
-
-  return st == state::component_or_delim;
+  return is_valid_uri(p, uri_rules::strict);
 }
 
 
@@ -149,6 +125,7 @@ std::string compute_salted_password(const char* pwd,
                                     int iterations,
                                     int keylen)
 {
+  XXX_INSTRUMENT_SCOPE(salted_password);
   const char* hexalphabet = "0123456789abcdef";
 
   unsigned char * md = (unsigned char *) malloc(sizeof(unsigned char) * keylen);
@@ -161,7 +138,10 @@ std::string compute_salted_password(const char* pwd,
                        iterations,
                        EVP_sha256(),
                        keylen, md) == 0)
+  {
+    XXX_INSTRUMENT_ERROR();
     throw std::runtime_error("PKCS5_PBKDF2_HMAC failed");
+  }
 
 
    // TODO: convert to hex
@@ -184,6 +164,7 @@ int compute_HMACSHA256(const char* key, int keylen, const char* msg, int msglen,
                        char* dest, unsigned int* destlen,
                        HMACSHA256_Mode output_mode)
 {
+  XXX_INSTRUMENT_SCOPE(hmac_sha256);
   const char* hexalphabet = "0123456789abcdef";
   const char* base64 =
       "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -316,10 +297,33 @@ int compute_HMACSHA256(const char* key, int keylen, const char* msg, int msglen,
   /* cleanup HMAC */
   HMAC_CTX_cleanup(&ctx);
 
+  if (retval != 0)
+    XXX_INSTRUMENT_ERROR();
+
   return retval;
 }
 
 
+std::string random_ascii_string(const size_t len)
+{
+  XXX_INSTRUMENT_SCOPE(random_ascii_string);
+  std::string temp(len, 'x'); //  gets overwritten below
+  if (len)
+    random_ascii_fill(&temp[0], len);
+  return temp;
+}
+
+
+std::string random_hex_nonce(const size_t len)
+{
+  XXX_INSTRUMENT_SCOPE(random_hex_nonce);
+  std::string temp(len, 'x'); //  gets overwritten below
+  if (len)
+    random_hex_fill(&temp[0], len);
+  return temp;
+}
+
+
 std::string random_ascii_string(const size_t len, unsigned int seed)
 {
   std::string temp(len, 'x'); //  gets overwritten below
@@ -334,7 +338,20 @@ std::string random_ascii_string(const size_t len, unsigned int seed)
 }
 
 
+uint64_t random_scope_id()
+{
+  /* top 53 bits give [0, 2^53), shifted up by one */
+  return (random_uint64() >> 11) + 1;
+}
+
+
 std::string iso8601_utc_timestamp()
+{
+  return iso8601_utc_timestamp(wall_clock_now());
+}
+
+
+std::string iso8601_utc_timestamp(epoch_nanos t)
 {
   static constexpr char full_format[] = "2017-05-21T07:51:17.000Z"; // 24
   static constexpr char short_format[] = "2017-05-21T07:51:17";     // 19
@@ -343,14 +360,14 @@ std::string iso8601_utc_timestamp()
   static_assert(short_len == (sizeof short_format - 1),
                 "short_len check failed");
 
-  time_val tv = time_now();
-
   char buf[32] = {0};
   assert(sizeof buf > (sizeof full_format));
   assert(sizeof full_format > sizeof short_format);
 
   struct tm parts;
-  time_t rawtime = tv.sec;
+  time_t rawtime;
+  long nanos;
+  split_nanos(t, rawtime, nanos);
 
 #ifndef _WIN32
   gmtime_r(&rawtime, &parts);
@@ -365,10 +382,10 @@ std::string iso8601_utc_timestamp()
   int ec;
 #ifndef _WIN32
   ec = snprintf(&buf[short_len], sizeof(buf) - short_len, ".%03dZ",
-                (int)tv.usec / 1000);
+                (int)(nanos / 1000000));
 #else
   ec = sprintf_s(&buf[short_len], sizeof(buf) - short_len, ".%03dZ",
-                 (int)tv.usec / 1000);
+                 (int)(nanos / 1000000));
 #endif
   if (ec < 0)
     return "";
@@ -379,16 +396,29 @@ std::string iso8601_utc_timestamp()
 
 
 /* Extract list of strings from a wamp json_array */
-std::vector<std::string> strings(wampcc::json_array ja)
+std::vector<std::string> strings(const wampcc::json_array& ja)
 {
   std::vector<std::string> rv;
+  rv.reserve(ja.size());
 
   for (auto & x : ja)
     if (x.is_string())
-      rv.push_back(std::move(x.as_string()));
+      rv.push_back(x.as_string());
 
   return rv;
+}
+
+
+std::vector<std::string> strings(wampcc::json_array&& ja)
+{
+  std::vector<std::string> rv;
+  rv.reserve(ja.size());
 
+  for (auto & x : ja)
+    if (x.is_string())
+      rv.push_back(std::move(x.as_string()));
+
+  return rv;
 }
 
 
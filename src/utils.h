@@ -1,11 +1,24 @@
 #ifndef XXX_UTILS_H
 #define XXX_UTILS_H
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <new>
 #include <random>
+#include <stdexcept>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 #include "wampcc/wampcc.h"
 
+#include "clock.h"
+
 #define STRINGIZE2(s) #s
 #define STRINGIFY(s) STRINGIZE2(s)
 
@@ -36,31 +49,283 @@ private:
   uint64_t m_next;
 };
 
+
+/* Thread safe variant of global_scope_id_generator.  Produces the same
+ * sequence, 0 .. m_max then wrapping to 0, but any number of threads can
+ * share one instance.  A single fetch_add is used, rather than a compare and
+ * swap loop, with the wraparound applied on the returned value; the 64 bit
+ * counter itself will not overflow in practice. */
+class atomic_scope_id_generator
+{
+public:
+  static const uint64_t m_min = global_scope_id_generator::m_min;
+  static const uint64_t m_max = global_scope_id_generator::m_max;
+
+  atomic_scope_id_generator() : m_next(0) {}
+
+  uint64_t next() noexcept
+  {
+    return m_next.fetch_add(1, std::memory_order_relaxed) % (m_max + 1);
+  }
+
+private:
+  alignas(64) std::atomic<uint64_t> m_next;
+};
+
+
+/* Thread safe generator that hands out IDs in blocks.  Each thread takes a
+ * block_scope_id_generator::local, which reserves a range of block_size IDs
+ * from the shared counter at a time and then issues them without touching
+ * any shared state.  IDs are unique across threads, and lie in the same
+ * 0 .. m_max range as global_scope_id_generator, but are not issued in
+ * global order. */
+class block_scope_id_generator
+{
+public:
+  static const uint64_t m_min = global_scope_id_generator::m_min;
+  static const uint64_t m_max = global_scope_id_generator::m_max;
+
+  explicit block_scope_id_generator(uint64_t block_size = 1024)
+    : m_block_size(block_size ? block_size : 1), m_next(0) {}
+
+  block_scope_id_generator(const block_scope_id_generator&) = delete;
+  void operator=(const block_scope_id_generator&) = delete;
+
+  class local
+  {
+  public:
+    explicit local(block_scope_id_generator& owner)
+      : m_owner(&owner), m_pos(0), m_end(0) {}
+
+    uint64_t next() noexcept
+    {
+      if (m_pos == m_end)
+        m_pos = m_owner->reserve(m_end);
+      return (m_pos++) % (m_max + 1);
+    }
+
+  private:
+    block_scope_id_generator* m_owner;
+    uint64_t m_pos;
+    uint64_t m_end;
+  };
+
+  /* Reserve the next block; returns its start, and sets 'end' to one past
+   * its last raw counter value. */
+  uint64_t reserve(uint64_t& end) noexcept
+  {
+    uint64_t start = m_next.fetch_add(m_block_size, std::memory_order_relaxed);
+    end = start + m_block_size;
+    return start;
+  }
+
+private:
+  uint64_t m_block_size;
+  alignas(64) std::atomic<uint64_t> m_next;
+};
+
+
+/* Generate a random-scope ID, uniformly distributed over [1, 2^53] as the
+ * WAMP spec requires.  Safe to call from any thread. */
+uint64_t random_scope_id();
+
 /** Return if the string is a wamp strict URI */
 bool is_strict_uri(const char*) noexcept;
 
+// replace with std::string_view if C++17 present
+#if __cplusplus >= 201703L
+using std::string_view;
+#else
+class string_view
+{
+public:
+  typedef const char* const_iterator;
+  static const size_t npos = size_t(-1);
+
+  constexpr string_view() noexcept : m_data(nullptr), m_size(0) {}
+  constexpr string_view(const char* s, size_t len) noexcept
+    : m_data(s), m_size(len) {}
+  string_view(const char* s) noexcept : m_data(s), m_size(strlen(s)) {}
+  string_view(const std::string& s) noexcept
+    : m_data(s.data()), m_size(s.size()) {}
+
+  constexpr const char* data() const noexcept { return m_data; }
+  constexpr size_t size() const noexcept { return m_size; }
+  constexpr bool empty() const noexcept { return m_size == 0; }
+  constexpr char operator[](size_t i) const noexcept { return m_data[i]; }
+
+  const char* begin() const noexcept { return m_data; }
+  const char* end() const noexcept { return m_data + m_size; }
+
+  string_view substr(size_t pos, size_t len = npos) const
+  {
+    if (pos > m_size)
+      throw std::out_of_range("string_view::substr");
+    return string_view(m_data + pos, std::min(len, m_size - pos));
+  }
+
+  size_t find(char c, size_t pos = 0) const noexcept
+  {
+    for (; pos < m_size; ++pos)
+      if (m_data[pos] == c)
+        return pos;
+    return npos;
+  }
+
+private:
+  const char* m_data;
+  size_t m_size;
+};
+
+inline bool operator==(string_view a, string_view b) noexcept
+{
+  return a.size() == b.size() &&
+         (a.size() == 0 || memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+inline bool operator!=(string_view a, string_view b) noexcept
+{
+  return !(a == b);
+}
+#endif
+
+namespace detail
+{
+
+/* Storage for maybe<T>: the value lives in place, in a union, and is
+ * constructed only when set.  For trivially copyable T the storage, and so
+ * maybe<T>, is itself trivially copyable. */
+template <typename T,
+          bool = std::is_trivially_copyable<T>::value &&
+                 std::is_trivially_destructible<T>::value>
+struct maybe_storage
+{
+  maybe_storage() noexcept : m_empty(), m_has(false) {}
+
+  maybe_storage(const maybe_storage& other) : m_empty(), m_has(false)
+  {
+    if (other.m_has)
+      construct(other.m_value);
+  }
+
+  maybe_storage(maybe_storage&& other) noexcept(
+    std::is_nothrow_move_constructible<T>::value)
+    : m_empty(), m_has(false)
+  {
+    if (other.m_has)
+      construct(std::move(other.m_value));
+  }
+
+  maybe_storage& operator=(const maybe_storage& other)
+  {
+    if (m_has && other.m_has)
+      m_value = other.m_value;
+    else if (other.m_has)
+      construct(other.m_value);
+    else
+      reset();
+    return *this;
+  }
+
+  maybe_storage& operator=(maybe_storage&& other) noexcept(
+    std::is_nothrow_move_constructible<T>::value &&
+    std::is_nothrow_move_assignable<T>::value)
+  {
+    if (m_has && other.m_has)
+      m_value = std::move(other.m_value);
+    else if (other.m_has)
+      construct(std::move(other.m_value));
+    else
+      reset();
+    return *this;
+  }
+
+  ~maybe_storage() { reset(); }
+
+  template <typename... Args> void construct(Args&&... args)
+  {
+    new (&m_value) T(std::forward<Args>(args)...);
+    m_has = true;
+  }
+
+  void reset() noexcept
+  {
+    if (m_has) {
+      m_value.~T();
+      m_has = false;
+    }
+  }
+
+  union
+  {
+    char m_empty;
+    T m_value;
+  };
+  bool m_has;
+};
+
+template <typename T> struct maybe_storage<T, true>
+{
+  maybe_storage() noexcept : m_empty(), m_has(false) {}
+
+  template <typename... Args> void construct(Args&&... args)
+  {
+    new (&m_value) T(std::forward<Args>(args)...);
+    m_has = true;
+  }
+
+  void reset() noexcept { m_has = false; }
+
+  union
+  {
+    char m_empty;
+    T m_value;
+  };
+  bool m_has;
+};
+
+} // namespace detail
+
 // replace with optional<> if C++17 present
-template <typename T> struct maybe
+template <typename T> struct maybe : private detail::maybe_storage<T>
 {
   maybe() = default;
 
-  maybe(T t)
-    : m_value(std::move(t), true) {}
+  maybe(T t) { this->construct(std::move(t)); }
 
   maybe& operator=(T v)
   {
-    m_value.first = std::move(v);
-    m_value.second = true;
+    if (this->m_has)
+      this->m_value = std::move(v);
+    else
+      this->construct(std::move(v));
     return *this;
   }
-  const T& value() const { return m_value.first; }
-  T& value() { return m_value.first; }
-  constexpr operator bool() const { return m_value.second; }
-private:
-  std::pair<T,bool> m_value;
+
+  template <typename... Args> T& emplace(Args&&... args)
+  {
+    this->reset();
+    this->construct(std::forward<Args>(args)...);
+    return this->m_value;
+  }
+
+  void reset() noexcept { detail::maybe_storage<T>::reset(); }
+
+  /* Undefined if empty */
+  const T& value() const { return this->m_value; }
+  T& value() { return this->m_value; }
+  constexpr operator bool() const { return this->m_has; }
 };
 
 
+/* Number of exceptions in flight on this thread, as the C++17
+ * std::uncaught_exceptions() */
+int uncaught_exception_count() noexcept;
+
+
+/* Runs an undo callable on leaving scope.  The callable is held in a
+ * std::function, so a capturing lambda may be heap allocated; prefer
+ * scope_exit() where the guard type need not be named. */
 class scope_guard
 {
 public:
@@ -90,7 +355,87 @@ private:
   std::function<void()> m_fn;
 };
 
-  std::string local_timestamp();
+
+/* When a basic_scope_guard runs its callable: on any scope exit, only when
+ * the scope is left by an exception, or only when it is not. */
+enum class scope_policy { exit, fail, success };
+
+/* Scope guard holding its callable inline, with no type erasure or
+ * allocation.  Create with scope_exit(), scope_fail() or scope_success():
+ *
+ *   auto guard = scope_fail([&]() { rollback(); });
+ */
+template <typename F, scope_policy P>
+class basic_scope_guard
+{
+public:
+  explicit basic_scope_guard(F fn)
+    : m_fn(std::move(fn)),
+      m_active(true),
+      m_exceptions(P == scope_policy::exit ? 0 : uncaught_exception_count())
+  {
+  }
+
+  basic_scope_guard(basic_scope_guard&& other)
+    : m_fn(std::move(other.m_fn)),
+      m_active(other.m_active),
+      m_exceptions(other.m_exceptions)
+  {
+    other.m_active = false;
+  }
+
+  ~basic_scope_guard()
+  {
+    if (m_active && should_run())
+      m_fn(); // must not throw
+  }
+
+  void dismiss() noexcept { m_active = false; }
+
+  basic_scope_guard(const basic_scope_guard&) = delete;
+  void operator=(const basic_scope_guard&) = delete;
+
+private:
+  bool should_run() const noexcept
+  {
+    if (P == scope_policy::exit)
+      return true;
+    bool unwinding = uncaught_exception_count() > m_exceptions;
+    return (P == scope_policy::fail) == unwinding;
+  }
+
+  F m_fn;
+  bool m_active;
+  int m_exceptions; /* in flight when created */
+};
+
+template <typename F>
+basic_scope_guard<typename std::decay<F>::type, scope_policy::exit>
+scope_exit(F&& fn)
+{
+  return basic_scope_guard<typename std::decay<F>::type, scope_policy::exit>(
+    std::forward<F>(fn));
+}
+
+template <typename F>
+basic_scope_guard<typename std::decay<F>::type, scope_policy::fail>
+scope_fail(F&& fn)
+{
+  return basic_scope_guard<typename std::decay<F>::type, scope_policy::fail>(
+    std::forward<F>(fn));
+}
+
+template <typename F>
+basic_scope_guard<typename std::decay<F>::type, scope_policy::success>
+scope_success(F&& fn)
+{
+  return basic_scope_guard<typename std::decay<F>::type,
+                           scope_policy::success>(std::forward<F>(fn));
+}
+
+/* Generate local timestamp, like YYYYMMDD-hh:mm:ss.uuuuuu */
+std::string local_timestamp();
+std::string local_timestamp(epoch_nanos);
 
 enum class HMACSHA256_Mode { HEX, BASE64 };
 
@@ -105,15 +450,25 @@ std::string compute_salted_password(const char* password,
 
 
 
-/* Generate a random string of ascii printables of length 'len' */
-std::string random_ascii_string(const size_t len,
-                                unsigned int seed = std::random_device()());
+/* Generate a random string of ascii printables of length 'len', from the
+ * thread-local CSPRNG; suitable for authentication challenges */
+std::string random_ascii_string(const size_t len);
+
+/* As above, but deterministic for a given seed; not for security use */
+std::string random_ascii_string(const size_t len, unsigned int seed);
+
+/* Generate a random nonce of 'len' lower case hex digits, from the
+ * thread-local CSPRNG */
+std::string random_hex_nonce(const size_t len);
 
 /* Generate iso8601 timestamp, like YYYY-MM-DDThh:mm:ss.sssZ */
 std::string iso8601_utc_timestamp();
+std::string iso8601_utc_timestamp(epoch_nanos);
 
-/* Extract list of strings from a wamp json_array */
-std::vector<std::string> strings(wampcc::json_array);
+/* Extract list of strings from a wamp json_array.  The rvalue overload moves
+ * the strings out of the array.  See json_args.h for non-copying views. */
+std::vector<std::string> strings(const wampcc::json_array&);
+std::vector<std::string> strings(wampcc::json_array&&);
 
 }
 
@@ -0,0 +1,87 @@
+/*
+ * Known-answer check for the multi-lane PBKDF2-HMAC-SHA256 of pbkdf2.h,
+ * against the vectors of RFC 7914 section 11 and values computed with
+ * OpenSSL's PKCS5_PBKDF2_HMAC.
+ *
+ * Build and run, from the top of the tree, with the wampcc headers on the
+ * include path:
+ *
+ *   g++ -O2 -std=c++11 -Isrc test/pbkdf2_kat.cc src/pbkdf2.cc src/clock.cc \
+ *       -lpthread -o pbkdf2_kat && ./pbkdf2_kat
+ *
+ * Each vector is derived alone, and in a batch large enough to fill every
+ * lane, on one thread and on several.  Exits non-zero on any mismatch.
+ */
+
+#include "pbkdf2.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct vector
+{
+  std::string password;
+  std::string salt;
+  int iterations;
+  int keylen;
+  const char* key; /* hex */
+};
+
+const vector vectors[] = {
+  {"password", "salt", 1, 32,
+   "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"},
+  {"password", "salt", 2, 32,
+   "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43"},
+  {"password", "salt", 4096, 32,
+   "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"},
+  {"passwd", "salt", 1, 64,
+   "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+   "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"},
+  {"Password", "NaCl", 80000, 64,
+   "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+   "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d"},
+  /* password longer than a SHA-256 block, key not a multiple of 32 */
+  {std::string(100, 'p'), "long password salt", 1000, 40,
+   "faba5365438940da827e926d66a63731d856d4af1ab13590d23a19106882db8e"
+   "13f7d1dc4d5e178f"},
+  {"", "salt", 3, 32,
+   "5ddf839afa2d5fb4be56e1a0f48917617559bef61ec122bfca1c7f75ac8f401d"},
+};
+
+} // namespace
+
+
+int main()
+{
+  int failures = 0;
+  int checks = 0;
+
+  for (const vector& v : vectors)
+    for (size_t batch : {1, 19})
+      for (unsigned threads : {1u, 4u}) {
+        std::vector<xxx::pbkdf2_input> inputs(batch,
+                                              {v.password, v.salt});
+        std::vector<std::string> keys = xxx::compute_salted_passwords(
+          inputs, v.iterations, v.keylen, threads);
+
+        checks++;
+        for (size_t i = 0; i < keys.size(); i++)
+          if (keys[i] != v.key) {
+            printf("FAIL password length %zu, salt '%s', iterations %d, "
+                   "batch %zu, threads %u, item %zu\n  got      %s\n"
+                   "  expected %s\n",
+                   v.password.size(), v.salt.c_str(), v.iterations, batch,
+                   threads, i, keys[i].c_str(), v.key);
+            failures++;
+            break;
+          }
+      }
+
+  printf("%s: %d of %d PBKDF2 checks failed\n", failures ? "FAIL" : "PASS",
+         failures, checks);
+  return failures ? 1 : 0;
+}
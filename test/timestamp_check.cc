@@ -0,0 +1,145 @@
+/*
+ * Round-trip and limits check for the timestamp parsers of timestamp.h.
+ *
+ * Build and run, from the top of the tree, alongside wampcc and OpenSSL:
+ *
+ *   g++ -O2 -std=c++11 -Isrc test/timestamp_check.cc src/timestamp.cc \
+ *       src/utils.cc src/clock.cc src/uri.cc src/csprng.cc \
+ *       src/instrument.cc -lcrypto -lpthread -o timestamp_check \
+ *     && ./timestamp_check
+ *
+ * Random instants over the whole epoch_nanos range are formatted with
+ * iso8601_utc_timestamp and local_timestamp, in several time zones, and
+ * parsed back; then instants at and just beyond the limits of the range
+ * are checked.  Exits non-zero on any failure.
+ */
+
+#include "timestamp.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <time.h>
+
+namespace
+{
+
+int failures = 0;
+
+void fail(const std::string& what, const std::string& input)
+{
+  printf("FAIL %s: '%s'\n", what.c_str(), input.c_str());
+  failures++;
+}
+
+/* Round 't' down to a multiple of 'unit' */
+xxx::epoch_nanos floor_to(xxx::epoch_nanos t, int64_t unit)
+{
+  int64_t r = t % unit;
+  return r < 0 ? t - r - unit : t - r;
+}
+
+void check_round_trip(xxx::epoch_nanos t)
+{
+  const xxx::epoch_nanos sentinel = 12345;
+
+  std::string iso = xxx::iso8601_utc_timestamp(t);
+  xxx::epoch_nanos parsed = sentinel;
+  if (!xxx::parse_iso8601(iso, parsed) || parsed != floor_to(t, 1000000))
+    fail("iso8601 round trip", iso);
+
+  xxx::string_view view(iso);
+  bool ok = false;
+  xxx::epoch_nanos batched = sentinel;
+  if (xxx::parse_iso8601_batch(&view, 1, &batched, &ok) != 1 || !ok ||
+      batched != parsed)
+    fail("iso8601 batch round trip", iso);
+
+  /* within a repeated local hour the earlier instant is returned, so check
+   * that the string, rather than the instant, survives */
+  std::string local = xxx::local_timestamp(t);
+  parsed = sentinel;
+  if (!xxx::parse_local_timestamp(local, parsed) ||
+      xxx::local_timestamp(parsed) != local)
+    fail("local round trip", local);
+}
+
+void expect_iso8601(const char* s, bool valid, xxx::epoch_nanos want = 0)
+{
+  const xxx::epoch_nanos sentinel = 12345;
+  xxx::epoch_nanos t = sentinel;
+  bool ok = xxx::parse_iso8601(s, t);
+
+  if (ok != valid || (valid && t != want) || (!valid && t != sentinel))
+    fail(valid ? "iso8601 in range" : "iso8601 out of range", s);
+
+  xxx::string_view view(s);
+  xxx::epoch_nanos batched = sentinel;
+  bool batch_ok = !valid;
+  xxx::parse_iso8601_batch(&view, 1, &batched, &batch_ok);
+  if (batch_ok != valid || (valid && batched != want))
+    fail(valid ? "iso8601 batch in range" : "iso8601 batch out of range", s);
+}
+
+void expect_local_rejected(const char* s)
+{
+  xxx::epoch_nanos t = 0;
+  if (xxx::parse_local_timestamp(s, t))
+    fail("local out of range", s);
+}
+
+} // namespace
+
+
+int main()
+{
+  const char* zones[] = {"UTC", "America/New_York", "Europe/London",
+                         "Australia/Lord_Howe", "Asia/Kathmandu"};
+  std::mt19937_64 engine(20261018);
+
+  /* the earliest whole millisecond in range, so that the millisecond the
+   * formatter writes is also in range */
+  const xxx::epoch_nanos lowest = -9223372036854000000LL;
+  std::uniform_int_distribution<int64_t> anywhere(lowest, INT64_MAX);
+  std::uniform_int_distribution<int64_t> recent(0, 4102444800LL * 1000000000);
+
+  for (const char* zone : zones) {
+    setenv("TZ", zone, 1);
+    tzset();
+    for (int i = 0; i < 20000; i++) {
+      check_round_trip(anywhere(engine));
+      check_round_trip(recent(engine));
+    }
+    check_round_trip(lowest);
+    check_round_trip(INT64_MAX);
+  }
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  expect_iso8601("2262-04-11T23:47:16.854Z", true, 9223372036854000000LL);
+  expect_iso8601("2262-04-11T23:47:16.854775807Z", true, INT64_MAX);
+  expect_iso8601("2262-04-11T23:47:16.854775808Z", false);
+  expect_iso8601("1677-09-21T00:12:43.146Z", true, -9223372036854000000LL);
+  expect_iso8601("1677-09-21T00:12:43.145224192Z", true, INT64_MIN);
+  expect_iso8601("1677-09-21T00:12:43.145224191Z", false);
+  expect_iso8601("1677-09-21T00:12:43.145Z", false);
+  expect_iso8601("2262-04-12T00:00:00.000Z", false);
+  expect_iso8601("3000-01-01T00:00:00.000Z", false);
+  expect_iso8601("9999-12-31T23:59:59.999Z", false);
+  expect_iso8601("0000-01-01T00:00:00.000Z", false);
+  expect_iso8601("9999-12-31", false);
+  expect_iso8601("1600-01-01", false);
+  expect_iso8601("2262-04-11T23:47:16.854-00:01", false);
+  expect_iso8601("1677-09-21T00:12:43.146+00:01", false);
+
+  expect_local_rejected("30000101-00:00:00.000000");
+  expect_local_rejected("22620412-00:00:00.000000");
+  expect_local_rejected("16000101-00:00:00.000000");
+  expect_local_rejected("16770920-00:00:00.000000");
+
+  printf("%s: %d timestamp checks failed\n", failures ? "FAIL" : "PASS",
+         failures);
+  return failures ? 1 : 0;
+}